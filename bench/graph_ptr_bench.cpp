@@ -0,0 +1,497 @@
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+#include "graph_ptr.hpp"
+
+// run with --benchmark_format=json (or --benchmark_out=<file>
+// --benchmark_out_format=json) to record results for tracking over time.
+
+namespace {
+
+    struct node {
+        node(int v = 0) : val(v)
+        {}
+
+        int val;
+        gptr::graph_ptr<node> next;
+    };
+
+    struct pair_node {
+        gptr::graph_ptr<pair_node> left;
+        gptr::graph_ptr<pair_node> right;
+    };
+
+    struct A;
+    struct B;
+    struct C;
+
+    struct A {
+        A(std::string str = {}) : val(str)
+        {}
+
+        std::string val;
+        gptr::graph_ptr<B> ptr;
+    };
+
+    struct B {
+        B(std::string str = {}) : val(str)
+        {}
+
+        std::string val;
+        gptr::graph_ptr<C> ptr;
+    };
+
+    struct C {
+        C(std::string str = {}) : val(str)
+        {}
+
+        std::string val;
+        gptr::graph_ptr<A> ptr;
+    };
+
+    struct D : gptr::enable_self_ptr<D> {
+        D() {
+        }
+
+        D(gptr::ptr_graph& g, std::string str1, std::string str2, std::string str3) :
+                gptr::enable_self_ptr<D>(g) {
+            a = g.make<A>(self_ptr(), str1);
+            b = g.make<B>(self_ptr(), str2);
+            c = g.make<C>(self_ptr(), str3);
+
+            c->ptr = gptr::graph_ptr<A>(c, a);
+        }
+
+        gptr::graph_ptr<A> a;
+        gptr::graph_ptr<B> b;
+        gptr::graph_ptr<C> c;
+    };
+
+    gptr::graph_root_ptr<A> make_cycle(gptr::ptr_graph& g) {
+        auto a = g.make_root<A>("a");
+        auto b = g.make_root<B>("b");
+        auto c = g.make_root<C>("c");
+
+        a->ptr = gptr::graph_ptr<B>(a, b);
+        b->ptr = gptr::graph_ptr<C>(b, c);
+        c->ptr = gptr::graph_ptr<A>(c, a);
+
+        return a;
+    }
+
+    // builds num_chains chains of chain_length nodes, each hanging off a root.
+    std::vector<gptr::graph_root_ptr<node>> make_chains(gptr::ptr_graph& g,
+            size_t num_chains, size_t chain_length) {
+        std::vector<gptr::graph_root_ptr<node>> roots;
+        roots.reserve(num_chains);
+        for (size_t i = 0; i < num_chains; ++i) {
+            auto root = g.make_root<node>(static_cast<int>(i));
+            gptr::graph_ptr<node> tail(root, root);
+            for (size_t j = 1; j < chain_length; ++j) {
+                auto next = g.make<node>(tail, static_cast<int>(j));
+                gptr::graph_root_ptr<node> owner(tail);
+                owner->next = std::move(next);
+                tail = gptr::graph_ptr<node>(owner->next, owner->next);
+            }
+            roots.push_back(root);
+        }
+        return roots;
+    }
+
+    // n nodes, each reached along a chain through left in random order, with
+    // right pointing at a random node. returns the root of the chain.
+    gptr::graph_root_ptr<pair_node> make_random_graph(gptr::ptr_graph& g, size_t n) {
+        std::vector<gptr::graph_root_ptr<pair_node>> nodes;
+        nodes.reserve(n);
+        for (size_t i = 0; i < n; ++i) {
+            nodes.push_back(g.make_root<pair_node>());
+        }
+        std::mt19937 rng(42);
+        std::vector<size_t> order(n);
+        for (size_t i = 0; i < n; ++i) {
+            order[i] = i;
+        }
+        std::shuffle(order.begin() + 1, order.end(), rng);
+        for (size_t i = 0; i + 1 < n; ++i) {
+            auto& u = nodes[order[i]];
+            u->left = gptr::graph_ptr<pair_node>(u, nodes[order[i + 1]]);
+            u->right = gptr::graph_ptr<pair_node>(u, nodes[rng() % n]);
+        }
+        return nodes[0];
+    }
+
+}
+
+static void BM_make_root(benchmark::State& state) {
+    size_t n = static_cast<size_t>(state.range(0));
+    for (auto _ : state) {
+        gptr::ptr_graph g(n);
+        std::vector<gptr::graph_root_ptr<node>> roots;
+        roots.reserve(n);
+        for (size_t i = 0; i < n; ++i) {
+            roots.push_back(g.make_root<node>(static_cast<int>(i)));
+        }
+        benchmark::DoNotOptimize(roots.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_make_root)->Range(1 << 10, 1 << 16);
+
+static void BM_make(benchmark::State& state) {
+    size_t n = static_cast<size_t>(state.range(0));
+    for (auto _ : state) {
+        gptr::ptr_graph g(n);
+        auto root = g.make_root<node>(0);
+        gptr::graph_ptr<node> parent(root, root);
+        for (size_t i = 0; i < n; ++i) {
+            auto child = g.make<node>(parent, static_cast<int>(i));
+            benchmark::DoNotOptimize(child.get());
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_make)->Range(1 << 10, 1 << 16);
+
+static void BM_make_many(benchmark::State& state) {
+    size_t n = static_cast<size_t>(state.range(0));
+    for (auto _ : state) {
+        gptr::ptr_graph g(n);
+        auto root = g.make_root<node>(0);
+        gptr::graph_ptr<node> parent(root, root);
+        auto children = g.make_many<node>(parent, n, 1);
+        benchmark::DoNotOptimize(children.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_make_many)->Range(1 << 10, 1 << 16);
+
+static void BM_make_roots_batch(benchmark::State& state) {
+    size_t n = static_cast<size_t>(state.range(0));
+    for (auto _ : state) {
+        gptr::ptr_graph g(n);
+        auto roots = g.make_roots_batch<node>(n, 1);
+        benchmark::DoNotOptimize(roots.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_make_roots_batch)->Range(1 << 10, 1 << 16);
+
+static void BM_get(benchmark::State& state) {
+    size_t n = static_cast<size_t>(state.range(0));
+    gptr::ptr_graph g(n);
+    std::vector<gptr::graph_root_ptr<node>> roots;
+    for (size_t i = 0; i < n; ++i) {
+        roots.push_back(g.make_root<node>(static_cast<int>(i)));
+    }
+    for (auto _ : state) {
+        int sum = 0;
+        for (auto& root : roots) {
+            sum += root->val;
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_get)->Range(1 << 10, 1 << 16);
+
+static void BM_graph_ptr_move(benchmark::State& state) {
+    gptr::ptr_graph g(16);
+    auto root = g.make_root<node>(0);
+    gptr::graph_ptr<node> a(root, root);
+    gptr::graph_ptr<node> b;
+    for (auto _ : state) {
+        b = std::move(a);
+        a = std::move(b);
+        benchmark::DoNotOptimize(a);
+    }
+    state.SetItemsProcessed(state.iterations() * 2);
+}
+BENCHMARK(BM_graph_ptr_move);
+
+static void BM_graph_ptr_create_destroy(benchmark::State& state) {
+    gptr::ptr_graph g(16);
+    auto u = g.make_root<node>(0);
+    auto v = g.make_root<node>(1);
+    for (auto _ : state) {
+        gptr::graph_ptr<node> p(u, v);
+        benchmark::DoNotOptimize(p);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_graph_ptr_create_destroy);
+
+static void BM_graph_root_ptr_copy(benchmark::State& state) {
+    gptr::ptr_graph g(16);
+    auto root = g.make_root<node>(0);
+    for (auto _ : state) {
+        gptr::graph_root_ptr<node> copy(root);
+        benchmark::DoNotOptimize(copy);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_graph_root_ptr_copy);
+
+// collect() latency against heap size (range 0, in objects) and the percentage of
+// objects that survive (range 1). objects form chains of 8.
+static void BM_collect(benchmark::State& state) {
+    constexpr size_t chain_length = 8;
+    size_t n = static_cast<size_t>(state.range(0));
+    size_t survivors = n * static_cast<size_t>(state.range(1)) / 100;
+    for (auto _ : state) {
+        state.PauseTiming();
+        gptr::ptr_graph g(n);
+        auto roots = make_chains(g, n / chain_length, chain_length);
+        roots.resize(survivors / chain_length);
+        state.ResumeTiming();
+
+        g.collect();
+
+        state.PauseTiming();
+        roots.clear();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_collect)
+    ->ArgsProduct({ { 1 << 12, 1 << 15, 1 << 18 }, { 0, 10, 50, 90, 100 } })
+    ->Unit(benchmark::kMicrosecond);
+
+// a collection of 2^18 objects, half of them garbage, followed by making as many
+// objects as it freed, with eager (range 0 = 0) or lazy (1) sweeping. the pause
+// is the time spent in collect(); the rest of the time includes the lazy sweep.
+static void BM_collect_lazy(benchmark::State& state) {
+    constexpr size_t chain_length = 8;
+    constexpr size_t n = 1 << 18;
+    bool lazy = state.range(0) != 0;
+    std::chrono::duration<double> pauses(0);
+    for (auto _ : state) {
+        state.PauseTiming();
+        gptr::ptr_graph g(n);
+        g.enable_lazy_sweep(lazy);
+        auto roots = make_chains(g, n / chain_length, chain_length);
+        roots.resize(roots.size() / 2);
+        state.ResumeTiming();
+
+        auto start = std::chrono::steady_clock::now();
+        g.collect();
+        pauses += std::chrono::steady_clock::now() - start;
+        auto refill = make_chains(g, n / chain_length / 2, chain_length);
+
+        state.PauseTiming();
+        refill.clear();
+        roots.clear();
+        state.ResumeTiming();
+    }
+    state.counters["pause_us"] = benchmark::Counter(
+        pauses.count() * 1e6 / static_cast<double>(state.iterations())
+    );
+}
+BENCHMARK(BM_collect_lazy)->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond);
+
+// mark time of a full collection that frees nothing, against heap size. every
+// node is reached along a chain through left in random order, and right points
+// at a random node, so the marker's accesses have no locality.
+static void BM_mark(benchmark::State& state) {
+    size_t n = static_cast<size_t>(state.range(0));
+    gptr::ptr_graph g(n);
+    auto root = make_random_graph(g, n);
+
+    for (auto _ : state) {
+        g.collect();
+        auto mark_time = g.stats().last.mark_time;
+        state.SetIterationTime(std::chrono::duration<double>(mark_time).count());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_mark)
+    ->Arg(1 << 16)->Arg(1 << 19)->Arg(1 << 21)
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond);
+
+// top_retainers(), which builds the dominator tree of the whole heap, on the
+// graph BM_mark traces plus as many nodes again in chains of 8 off their own
+// roots, against the number of nodes in the random graph.
+static void BM_top_retainers(benchmark::State& state) {
+    size_t n = static_cast<size_t>(state.range(0));
+    gptr::ptr_graph g(2 * n);
+    auto root = make_random_graph(g, n);
+    auto chains = make_chains(g, n / 8, 8);
+
+    for (auto _ : state) {
+        auto top = g.top_retainers(10);
+        benchmark::DoNotOptimize(top.data());
+    }
+    state.SetItemsProcessed(state.iterations() * 2 * state.range(0));
+}
+BENCHMARK(BM_top_retainers)
+    ->Arg(1 << 16)->Arg(1 << 19)
+    ->Unit(benchmark::kMillisecond);
+
+// unreachable three node cycles, as built by make_cycle in main.cpp.
+static void BM_collect_cycles(benchmark::State& state) {
+    size_t n = static_cast<size_t>(state.range(0));
+    for (auto _ : state) {
+        state.PauseTiming();
+        gptr::ptr_graph g(3 * n);
+        for (size_t i = 0; i < n; ++i) {
+            make_cycle(g);
+        }
+        state.ResumeTiming();
+
+        g.collect();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0) * 3);
+}
+BENCHMARK(BM_collect_cycles)->Range(1 << 8, 1 << 14)->Unit(benchmark::kMicrosecond);
+
+// unreachable trees built through enable_self_ptr, like struct D in main.cpp.
+static void BM_collect_self_ptr_trees(benchmark::State& state) {
+    size_t n = static_cast<size_t>(state.range(0));
+    for (auto _ : state) {
+        state.PauseTiming();
+        gptr::ptr_graph g(4 * n);
+        for (size_t i = 0; i < n; ++i) {
+            g.make_root<D>(g, "a", "b", "c");
+        }
+        state.ResumeTiming();
+
+        g.collect();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0) * 4);
+}
+BENCHMARK(BM_collect_self_ptr_trees)->Range(1 << 8, 1 << 14)->Unit(benchmark::kMicrosecond);
+
+// drops the roots of trees like those above and reclaims them, with a collection
+// (range 1 is 0) or by reference counting (range 1 is 1).
+static void BM_drop_self_ptr_trees(benchmark::State& state) {
+    size_t n = static_cast<size_t>(state.range(0));
+    bool counting = state.range(1) != 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        gptr::ptr_graph g(4 * n);
+        g.enable_reference_counting(counting);
+        std::vector<gptr::graph_root_ptr<D>> roots;
+        roots.reserve(n);
+        for (size_t i = 0; i < n; ++i) {
+            roots.push_back(g.make_root<D>(g, "a", "b", "c"));
+        }
+        state.ResumeTiming();
+
+        roots.clear();
+        if (!counting) {
+            g.collect();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0) * 4);
+}
+BENCHMARK(BM_drop_self_ptr_trees)
+    ->ArgsProduct({ { 1 << 8, 1 << 11, 1 << 14 }, { 0, 1 } })
+    ->Unit(benchmark::kMicrosecond);
+
+// drops the root of a three node cycle beside range(0) live nodes and reclaims
+// it, with a collection (range 1 is 0) or with collect_from() (range 1 is 1).
+static void BM_drop_cycle(benchmark::State& state) {
+    constexpr size_t chain_length = 64;
+    size_t n = static_cast<size_t>(state.range(0));
+    bool local = state.range(1) != 0;
+    gptr::ptr_graph g(n + 3);
+    g.enable_reverse_edges(local);
+    auto roots = make_chains(g, n / chain_length, chain_length);
+    for (auto _ : state) {
+        auto cycle = make_cycle(g);
+        if (local) {
+            g.collect_from(std::move(cycle));
+        } else {
+            cycle.reset();
+            g.collect();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * 3);
+}
+BENCHMARK(BM_drop_cycle)
+    ->ArgsProduct({ { 1 << 10, 1 << 14, 1 << 18 }, { 0, 1 } })
+    ->Unit(benchmark::kMicrosecond);
+
+// walks chains whose nodes were allocated interleaved with the other chains, after
+// a full collection with and without compaction in traversal order.
+static void BM_traverse_after_collect(benchmark::State& state) {
+    constexpr size_t num_chains = 1 << 10;
+    constexpr size_t chain_length = 256;
+    gptr::ptr_graph g(num_chains * chain_length);
+    g.enable_traversal_compaction(state.range(0) != 0);
+
+    std::vector<gptr::graph_root_ptr<node>> roots;
+    std::vector<gptr::graph_ptr<node>> tails;
+    roots.reserve(num_chains);
+    tails.reserve(num_chains);
+    for (size_t i = 0; i < num_chains; ++i) {
+        roots.push_back(g.make_root<node>(static_cast<int>(i)));
+        tails.emplace_back(roots.back(), roots.back());
+    }
+    for (size_t j = 1; j < chain_length; ++j) {
+        for (auto& tail : tails) {
+            auto next = g.make<node>(tail, static_cast<int>(j));
+            gptr::graph_root_ptr<node> owner(tail);
+            owner->next = std::move(next);
+            tail = gptr::graph_ptr<node>(owner->next, owner->next);
+        }
+    }
+    tails.clear();
+    g.collect();
+
+    for (auto _ : state) {
+        long long sum = 0;
+        for (const auto& root : roots) {
+            for (const node* n = root.get(); n; n = n->next ? n->next.get() : nullptr) {
+                sum += n->val;
+            }
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * num_chains * chain_length);
+}
+BENCHMARK(BM_traverse_after_collect)->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond);
+
+// loading chains from a snapshot, to compare with building them with make_chains.
+static void BM_snapshot_load(benchmark::State& state) {
+    constexpr size_t chain_length = 64;
+    const std::string path = "graph_ptr_bench.snap";
+    size_t n = static_cast<size_t>(state.range(0));
+
+    gptr::snapshot_types types;
+    types.add<node>("node",
+        [](const node& v, gptr::snapshot_writer& out) {
+            out.write(v.val);
+            out.write(v.next);
+        },
+        [](gptr::snapshot_reader& in) {
+            node v(in.read<int>());
+            v.next = in.read_ptr<node>();
+            return v;
+        }
+    );
+    {
+        gptr::ptr_graph g(n);
+        auto roots = make_chains(g, n / chain_length, chain_length);
+        g.save(path, types);
+    }
+
+    for (auto _ : state) {
+        gptr::ptr_graph g(n);
+        auto roots = g.load(path, types).take<node>();
+        benchmark::DoNotOptimize(roots.data());
+
+        state.PauseTiming();
+        roots.clear();
+        state.ResumeTiming();
+    }
+    std::remove(path.c_str());
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_snapshot_load)->Range(1 << 12, 1 << 18)->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
@@ -1,571 +1,4133 @@
 #pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
 #include <functional>
+#include <future>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <stdexcept>
 #include <tuple>
+#include <type_traits>
 #include <typeinfo>
 #include <typeindex>
 #include <unordered_map>
 #include <unordered_set>
-#include <stack>
 #include <string>
+#include <thread>
 #include <sstream>
+#include <utility>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace gptr {
 
-    namespace internal {
+    // the objects of one type in a ptr_graph's object store.
+    struct type_heap_stats {
+        size_t live_objects = 0;
+        size_t live_bytes = 0;
+        size_t freed_objects = 0;
+        size_t freed_bytes = 0;
+    };
 
-        template <typename T>
-        using should_collect_cb = bool(*)(const T&);
+    using type_heap_stats_map = std::unordered_map<std::type_index, type_heap_stats>;
 
-        template <typename T>
-        using on_moved_cb = void(*)(T&);
+    // called by a sweep with every object of one type that it is about to destroy.
+    // all objects dying in the sweep are still intact when finalizers run, so a
+    // finalizer may follow pointers to other dying objects, but it must not make
+    // objects or pointers in the graph.
+    template<typename T>
+    using finalizer = std::function<void(T* const* objs, size_t count)>;
+
+    // what one collection did. mark_time is summed over all the slices of an
+    // incremental collection. types holds the live heap after the collection and
+    // what it freed, per type.
+    struct collection_stats {
+        bool minor = false;
+        std::chrono::nanoseconds mark_time{ 0 };
+        std::chrono::nanoseconds sweep_time{ 0 };
+        size_t edges_traversed = 0;
+        size_t objects_freed = 0;
+        size_t bytes_freed = 0;
+        type_heap_stats_map types;
+    };
 
-        template<typename T>
-        class slab {
-        public:
-            slab() {
+    // cumulative statistics of a ptr_graph's collector. a pause is one call to
+    // collect(), collect_step() or collect_minor(); pause_histogram[i] counts the
+    // pauses that took less than 2^i microseconds but at least 2^(i-1).
+    struct gc_stats {
+        static constexpr size_t pause_buckets = 32;
+
+        size_t collections = 0;
+        size_t minor_collections = 0;
+        std::chrono::nanoseconds total_mark_time{ 0 };
+        std::chrono::nanoseconds total_sweep_time{ 0 };
+        size_t total_edges_traversed = 0;
+        size_t total_objects_freed = 0;
+        size_t total_bytes_freed = 0;
+        // objects reclaimed outside of collections, by reference counting or by
+        // collect_from().
+        size_t objects_released = 0;
+        size_t pauses = 0;
+        std::chrono::nanoseconds total_pause_time{ 0 };
+        std::chrono::nanoseconds longest_pause{ 0 };
+        std::array<size_t, pause_buckets> pause_histogram{};
+        collection_stats last;
+    };
 
-            }
+    struct heap_edge {
+        std::uint32_t target;
+        size_t count;
+    };
 
-            slab(size_t initial_capacity, should_collect_cb<T> sc, on_moved_cb<T> om) :
-                is_dead_(sc), on_moved_(om) {
-                impl_.reserve(initial_capacity);
-            }
+    // one object of a ptr_graph, as handed to the function passed to walk_heap().
+    // ids are cell indices, so they are unique among the objects of one walk but
+    // may be reused once an object is freed. size is the bytes the object takes
+    // in the object store, and edges lists the objects it points to, each with
+    // the number of pointers to it. retained_size and retained_objects cover
+    // what only this object keeps alive, itself included, i.e. what would be
+    // freed if it lost its last pointer. objects no root reaches, which are
+    // garbage the next collection frees, retain nothing.
+    struct heap_object {
+        std::uint32_t id = 0;
+        std::type_index type = std::type_index(typeid(void));
+        size_t size = 0;
+        size_t retained_size = 0;
+        size_t retained_objects = 0;
+        bool is_root = false;
+        bool reachable = false;
+        std::vector<heap_edge> edges;
+    };
 
-            template<typename... Args>
-            T* emplace(Args&&... args) {
-                impl_.emplace_back(std::forward<Args>(args)...);
-                return &(impl_.back());
-            }
+    // an object held by a root pointer, and what it alone keeps alive. the
+    // references of another graph are counted as a single retainer whose id is
+    // not an object's and whose type is void.
+    struct heap_retainer {
+        std::uint32_t id = 0;
+        std::type_index type = std::type_index(typeid(void));
+        size_t retained_size = 0;
+        size_t retained_objects = 0;
+    };
 
-            void collect() {
-                if (impl_.empty())
-                    return;
+    enum class heap_dump_format {
+        dot,
+        binary
+    };
 
-                auto front = impl_.begin();
-                auto back = std::prev(impl_.end());
+    namespace internal {
 
-                size_t total_collected = 0;
-                while (front <= back) {
-                    auto [back_is_alive, num_collected] = delete_dead_from_back(back);
-                    total_collected += num_collected;
-                    if (back_is_alive && back > front && is_dead_(*front)) {
-                        std::swap( *front, *back );
+        // an object id is a generational index: the low 32 bits are a slot index into
+        // the ptr_graph's cell table and the high 32 bits are the generation of that slot
+        // at the time the id was handed out. id 0 is reserved for the root cell.
 
-                        on_moved_(*front);
-                    }
-                    front++;
-                }
+        using obj_id_t = std::uint64_t;
+
+        constexpr std::uint32_t id_index(obj_id_t id) {
+            return static_cast<std::uint32_t>(id);
+        }
+
+        constexpr std::uint32_t id_generation(obj_id_t id) {
+            return static_cast<std::uint32_t>(id >> 32);
+        }
+
+        constexpr obj_id_t make_obj_id(std::uint32_t index, std::uint32_t generation) {
+            return (static_cast<obj_id_t>(generation) << 32) | index;
+        }
+
+        inline size_t floor_log2(size_t n) {
+#if defined(_MSC_VER)
+            unsigned long i;
+            _BitScanReverse64(&i, n);
+            return static_cast<size_t>(i);
+#else
+            return static_cast<size_t>(63 - __builtin_clzll(n));
+#endif
+        }
+
+        // a hint to start loading the cache line holding p.
+        inline void prefetch(const void* p) {
+#if defined(_MSC_VER)
+            _mm_prefetch(static_cast<const char*>(p), _MM_HINT_T0);
+#else
+            __builtin_prefetch(p);
+#endif
+        }
+
+        // an array of T that grows in segments of doubling size so that growing never
+        // moves existing elements. indexing is a shift, a bit scan, and two loads.
+        template<typename T>
+        class segmented_array {
+        public:
+            static constexpr size_t first_segment_bits = 10;
+            static constexpr size_t first_segment_size = size_t(1) << first_segment_bits;
+            static constexpr size_t max_segments = 24;
 
-                impl_.resize(impl_.size() - total_collected);
+            using allocator_type = std::pmr::polymorphic_allocator<T>;
+
+            explicit segmented_array(const allocator_type& alloc = {}) :
+                alloc_(alloc), segments_{}, size_(0), capacity_(0), num_segments_(0) {
             }
 
-            size_t size() const {
-                return impl_.size();
+            segmented_array(const segmented_array&) = delete;
+            segmented_array& operator=(const segmented_array&) = delete;
+
+            ~segmented_array() {
+                for (size_t seg = 0; seg < num_segments_; ++seg) {
+                    size_t seg_size = first_segment_size << seg;
+                    std::destroy_n(segments_[seg], seg_size);
+                    alloc_.deallocate(segments_[seg], seg_size);
+                }
             }
 
-            using iterator = typename std::vector<T>::iterator;
-            using const_iterator = typename std::vector<T>::const_iterator;
+            T& operator[](size_t i) {
+                auto [seg, offset] = locate(i);
+                return segments_[seg][offset];
+            }
 
-            iterator begin() {
-                return impl_.begin();
+            const T& operator[](size_t i) const {
+                auto [seg, offset] = locate(i);
+                return segments_[seg][offset];
             }
 
-            iterator end() {
-                return impl_.end();
+            T& grow() {
+                if (size_ == capacity_) {
+                    add_segment();
+                }
+                return (*this)[size_++];
             }
 
-            const_iterator begin() const {
-                return impl_.begin();
+            size_t size() const {
+                return size_;
             }
 
-            const_iterator end() const {
-                return impl_.end();
+            // the index of an element given its address.
+            size_t index_of(const T* p) const {
+                size_t first = 0;
+                for (size_t seg = 0; seg < num_segments_; ++seg) {
+                    size_t seg_size = first_segment_size << seg;
+                    const T* begin = segments_[seg];
+                    if (p >= begin && p < begin + seg_size)
+                        return first + static_cast<size_t>(p - begin);
+                    first += seg_size;
+                }
+                return size_;
             }
 
         private:
 
-            std::tuple<bool, size_t> delete_dead_from_back(iterator& back) {
-                size_t num_collected = 0;
-                bool past_begin = false;
-                while (!past_begin && is_dead_(*back)) {
-                    if (back != impl_.begin()) {
-                        --back;
-                    } else {
-                        past_begin = true;
-                    }
-                    ++num_collected;
+            // elements are constructed with the array's allocator, so an allocator
+            // aware T allocates from the same resource.
+            void add_segment() {
+                size_t seg_size = first_segment_size << num_segments_;
+                T* seg = alloc_.allocate(seg_size);
+                for (size_t i = 0; i < seg_size; ++i) {
+                    alloc_.construct(seg + i);
                 }
-                return { !past_begin, num_collected };
+                segments_[num_segments_++] = seg;
+                capacity_ += seg_size;
             }
 
-            std::vector<T> impl_;
-            should_collect_cb<T> is_dead_;
-            on_moved_cb<T> on_moved_;
-        };
+            static std::tuple<size_t, size_t> locate(size_t i) {
+                size_t biased = i + first_segment_size;
+                size_t seg = floor_log2(biased >> first_segment_bits);
+                return { seg, biased - (first_segment_size << seg) };
+            }
 
-        using obj_id_t = size_t;
+            allocator_type alloc_;
+            std::array<T*, max_segments> segments_;
+            size_t size_;
+            size_t capacity_;
+            size_t num_segments_;
+        };
 
-        class any_slab {
-            enum class func_enum {
-                collect,
-                destroy,
-                get_size
-            };
+        // one bit per cell, set when the marker shades the cell. testing a target
+        // here rather than in its cell means an edge to a cell that is already shaded
+        // does not have to load the cell. the words live in a segmented_array, so
+        // growing the bitmap never moves them out from under a write barrier.
+        class mark_bitmap {
         public:
+            using word_t = std::atomic<std::uint64_t>;
+            using allocator_type = std::pmr::polymorphic_allocator<word_t>;
 
-            any_slab(const any_slab& os) = delete;
-            any_slab(any_slab&& os) noexcept : slab_(os.slab_), fn_(os.fn_) {
-                os.slab_ = nullptr;
-                os.fn_ = {};
-            }
-            any_slab& operator=(const any_slab& os) = delete;
-            any_slab& operator=(any_slab&& os) noexcept {
-                slab_ = os.slab_;
-                fn_ = os.fn_;
-                os.slab_ = nullptr;
-                os.fn_ = {};
-                return *this;
+            explicit mark_bitmap(const allocator_type& alloc = {}) : words_(alloc) {
             }
 
-            template<typename T>
-            any_slab(size_t initial_capacity, should_collect_cb<T> is_dead_fn, on_moved_cb<T> on_moved_fn) :
-                slab_(
-                    new slab<T>(initial_capacity, is_dead_fn, on_moved_fn)
-                ),
-                fn_(
-                    [](func_enum cmd, void* ptr)->size_t {
-                        auto slab_ptr = static_cast<slab<T>*>(ptr);
-                        switch (cmd) {
-                        case func_enum::collect:
-                            slab_ptr->collect();
-                            return 0;
-
-                        case func_enum::get_size:
-                            return slab_ptr->size();
-
-                        case func_enum::destroy:
-                            delete slab_ptr;
-                            return 0;
-                        };
-                        return 0;
-                    }
-                )
-            { }
+            // makes room for bits [0, n).
+            void resize(size_t n) {
+                while (words_.size() * word_bits < n) {
+                    words_.grow();
+                }
+            }
 
-            template<typename T, typename... Args>
-            T* emplace(Args&&... args) {
-                slab<T>* slab_ptr = static_cast<slab<T>*>(slab_);
-                return slab_ptr->emplace(std::forward<Args>(args)...);
+            bool test(size_t i) const {
+                return words_[i / word_bits].load(std::memory_order_relaxed) & bit(i);
             }
 
-            void collect() {
-                fn_(func_enum::collect, slab_);
+            // sets bit i and returns true if it was clear. concurrent calls for bits
+            // in the same word are safe, and exactly one caller wins each bit.
+            bool set(size_t i) {
+                auto& word = words_[i / word_bits];
+                auto mask = bit(i);
+                if (word.load(std::memory_order_relaxed) & mask)
+                    return false;
+                return !(word.fetch_or(mask, std::memory_order_relaxed) & mask);
             }
 
-            size_t size() const {
-                return fn_(func_enum::get_size, slab_);
+            void reset(size_t i) {
+                words_[i / word_bits].fetch_and(~bit(i), std::memory_order_relaxed);
             }
 
-            ~any_slab() {
-                if (slab_) {
-                    fn_(func_enum::destroy, slab_);
-                    slab_ = nullptr;
+            void clear() {
+                for (size_t i = 0; i < words_.size(); ++i) {
+                    words_[i].store(0, std::memory_order_relaxed);
                 }
             }
 
         private:
+            static constexpr size_t word_bits = 64;
 
-            void* slab_;
-            std::function<size_t(func_enum, void*)> fn_;
-        };
-
-        struct ptr_graph_cell {
-            void* value;
-            bool gc_mark;
-            std::unordered_map<obj_id_t, size_t> adj_list;
+            static std::uint64_t bit(size_t i) {
+                return std::uint64_t(1) << (i % word_bits);
+            }
 
-            ptr_graph_cell(void* value = nullptr) : value(value), gc_mark(false)
-            {}
+            segmented_array<word_t> words_;
         };
 
-        template<typename T>
-        struct obj_store_cell {
-            ptr_graph_cell* graph_cell_ptr;
-            T value;
+        // target size in bytes of one block of a slab.
+        constexpr size_t slab_block_bytes = 64 * 1024;
+
+        // a slab is only split across threads by a parallel sweep if every thread gets
+        // at least this many objects.
+        constexpr size_t parallel_sweep_min_range = 16 * 1024;
+
+        // number of mutexes that edge mutation is striped across in a concurrent
+        // ptr_graph. a cell's edges are guarded by the stripe its index maps to.
+        constexpr size_t edge_lock_stripes = 64;
+
+        // objects or cells a lazy sweep checks on each allocation, and the most
+        // slots an allocation checks looking for a dead object's slot to reuse.
+        // whatever is left when the next collection starts is swept then.
+        constexpr size_t lazy_sweep_step = 32;
+
+        // coordinates the mutator threads of a concurrent ptr_graph with collections.
+        // every graph operation runs inside enter()/leave(); stop() waits until no
+        // operation is in progress and holds new ones off until resume(). a thread
+        // may re-enter a safepoint it is already inside, which happens when a
+        // constructor makes further objects or when a sweep runs destructors. a
+        // thread inside one graph may enter another, so a stop backs off while a
+        // thread inside it waits on another graph's stop, which could be waiting
+        // on a thread inside this one.
+        class safepoint {
+        public:
+            safepoint() : active_(0), parked_(0), stopping_(false) {
+            }
 
-            obj_store_cell() : graph_cell_ptr(nullptr) {
+            void enter() {
+                auto& entered = entered_by_this_thread();
+                if (is_entered()) {
+                    entered.push_back(this);
+                    return;
+                }
+                for (;;) {
+                    active_.fetch_add(1);
+                    if (!stopping_.load())
+                        break;
+                    release();
+                    for (auto sp : entered) sp->park();
+                    {
+                        std::unique_lock<std::mutex> lock(mutex_);
+                        resumed_.wait(lock, [&]() { return !stopping_.load(); });
+                    }
+                    for (auto sp : entered) sp->unpark();
+                }
+                entered.push_back(this);
             }
 
-            template<typename... Args>
-            obj_store_cell(Args&&... args) :
-                graph_cell_ptr(nullptr),
-                value(std::forward<Args>(args)...) {
+            void leave() {
+                entered_by_this_thread().pop_back();
+                if (!is_entered()) {
+                    release();
+                }
             }
-        };
 
-        class graph_obj_store {
+            void stop() {
+                collector_mutex_.lock();
+                size_t own = is_entered() ? 1 : 0;
+                std::unique_lock<std::mutex> lock(mutex_);
+                for (;;) {
+                    stopping_.store(true);
+                    drained_.wait(lock, [&]() { return active_.load() == own || parked_.load() > 0; });
+                    if (active_.load() == own)
+                        break;
+                    stopping_.store(false);
+                    resumed_.notify_all();
+                    drained_.wait(lock, [&]() { return parked_.load() == 0; });
+                }
+                entered_by_this_thread().push_back(this);
+            }
 
+            void resume() {
+                entered_by_this_thread().pop_back();
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    stopping_.store(false);
+                }
+                resumed_.notify_all();
+                collector_mutex_.unlock();
+            }
 
-        public:
+            // the safepoints the calling thread is inside of, innermost last.
+            static std::vector<safepoint*>& entered_by_this_thread() {
+                thread_local std::vector<safepoint*> entered;
+                return entered;
+            }
 
-            graph_obj_store(size_t initial_capacity) : initial_capacity_(initial_capacity) {
+        private:
+            bool is_entered() const {
+                const auto& entered = entered_by_this_thread();
+                return std::find(entered.begin(), entered.end(), this) != entered.end();
             }
 
-            template<typename T, typename... Args>
-            obj_store_cell<T>* emplace(Args&&... args) {
-                auto type_key = std::type_index(typeid(T));
-                auto iter = type_to_slab_.find(type_key);
-
-                if (iter == type_to_slab_.end()) {
-                    auto [i, success] = type_to_slab_.insert(
-                        std::pair<std::type_index, any_slab>(
-                            type_key,
-                            any_slab(
-                                initial_capacity_,
-                                should_collect_cb< obj_store_cell<T>>(
-                                    [](const obj_store_cell<T>& si) {
-                                        return !si.graph_cell_ptr->gc_mark;
-                                    }
-                                ),
-                                on_moved_cb< obj_store_cell<T>>(
-                                    [](obj_store_cell<T>& si) {
-                                        si.graph_cell_ptr->value = &(si.value);
-                                    }
-                                )
-                            )
-                        )
-                    );
-                    iter = i;
+            // a stopping thread may itself be inside, in which case it waits for
+            // the count to drop to 1 rather than 0.
+            void release() {
+                if (active_.fetch_sub(1) <= 2 && stopping_.load()) {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    drained_.notify_all();
                 }
-                any_slab& objs = iter->second;
-                obj_store_cell<T>* new_slab_item_ptr = objs.emplace<obj_store_cell<T>>(std::forward<Args>(args)...);
-                return new_slab_item_ptr;
             }
 
-            size_t size() const {
-                size_t sz = 0;
+            // marks a thread inside this safepoint as waiting on another one.
+            void park() {
+                parked_.fetch_add(1);
+                std::lock_guard<std::mutex> lock(mutex_);
+                drained_.notify_all();
+            }
 
-                for (const auto& [key, val] : type_to_slab_) {
-                    sz += val.size();
+            void unpark() {
+                if (parked_.fetch_sub(1) == 1) {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    drained_.notify_all();
                 }
+            }
 
-                return sz;
+            std::atomic<size_t> active_;
+            std::atomic<size_t> parked_;
+            std::atomic<bool> stopping_;
+            std::mutex mutex_;
+            std::mutex collector_mutex_;
+            std::condition_variable drained_;
+            std::condition_variable resumed_;
+        };
+
+        // runs an operation inside a safepoint, or does nothing given null.
+        class safepoint_scope {
+        public:
+            explicit safepoint_scope(safepoint* sp) : sp_(sp) {
+                if (sp_) sp_->enter();
             }
 
-            void collect() {
-                for (auto& [key, val] : type_to_slab_) {
-                    val.collect();
-                }
+            safepoint_scope(const safepoint_scope&) = delete;
+            safepoint_scope& operator=(const safepoint_scope&) = delete;
+
+            ~safepoint_scope() {
+                if (sp_) sp_->leave();
             }
 
         private:
-            size_t initial_capacity_;
-            std::unordered_map<std::type_index, any_slab> type_to_slab_;
+            safepoint* sp_;
         };
 
-        using obj_id_t = size_t;
+        // stops the world for the lifetime of the object, or does nothing given null.
+        class stop_the_world {
+        public:
+            explicit stop_the_world(safepoint* sp) : sp_(sp) {
+                if (sp_) sp_->stop();
+            }
 
-    }
+            stop_the_world(const stop_the_world&) = delete;
+            stop_the_world& operator=(const stop_the_world&) = delete;
 
-    template<typename T>
-    class graph_ptr;
+            ~stop_the_world() {
+                if (sp_) sp_->resume();
+            }
 
-    class ptr_graph;
+        private:
+            safepoint* sp_;
+        };
 
-    template<typename T>
-    class graph_root_ptr {
-        friend ptr_graph;
-        template<typename U> friend class graph_root_ptr;
-        template<typename U> friend class graph_ptr;
-    public:
+        // runs f(0) ... f(num_threads - 1) concurrently, f(0) on the calling thread.
+        // the workers inherit the caller's safepoints, so destructors run by a
+        // parallel sweep do not wait on the collection that is running them.
+        template<typename F>
+        void run_parallel(size_t num_threads, F f) {
+            std::vector<std::thread> workers;
+            workers.reserve(num_threads - 1);
+            const auto& entered = safepoint::entered_by_this_thread();
+            for (size_t i = 1; i < num_threads; ++i) {
+                workers.emplace_back(
+                    [&f, entered, i]() {
+                        safepoint::entered_by_this_thread() = entered;
+                        f(i);
+                    }
+                );
+            }
+            f(0);
+            for (auto& worker : workers) {
+                worker.join();
+            }
+        }
 
-        using value_type = T;
+        template <typename T>
+        using should_collect_cb = bool(*)(const T&);
 
-        graph_root_ptr() : v_(0), ptr_graph_(nullptr) {
-        }
+        template <typename T>
+        using on_moved_cb = void(*)(T&);
 
-        graph_root_ptr(const graph_root_ptr& v) :
-            graph_root_ptr(v.ptr_graph_, v.v_) {
-        }
+        // called on a nursery object that survived a minor collection. ages it and
+        // returns true if it should be promoted to the tenured slab.
+        template <typename T>
+        using on_survived_cb = bool(*)(T&, size_t promotion_age);
 
-        graph_root_ptr(const graph_ptr<T>& v) :
-            graph_root_ptr(v.ptr_graph_, v.v_) {
-        }
+        // the position an object should have after a collection that compacts in
+        // traversal order.
+        template <typename T>
+        using order_key_cb = std::uint32_t(*)(const T&);
 
-        graph_root_ptr(graph_root_ptr&& other) noexcept : ptr_graph_(other.ptr_graph_), v_(other.v_) {
-            other.wipe();
-        }
+        // called on a dead object just before a lazy sweep destroys it.
+        template <typename T>
+        using on_swept_cb = void(*)(T&);
+
+        // slab stores its objects in fixed size blocks indexed by a block table, so
+        // emplace never moves a live object. objects are kept densely packed and only
+        // move when collect() compacts survivors into holes. erase() and the lazy
+        // sweep destroy single objects in place, leaving holes that emplace() fills
+        // before growing; the other sweeps first move objects from the end into any
+        // such holes.
+        template<typename T>
+        class slab {
 
-        bool operator==(const graph_root_ptr& other) const {
-            return v_ == other.v_;
-        }
+            template<typename S, typename V>
+            class iterator_impl {
+            public:
+                using iterator_category = std::forward_iterator_tag;
+                using value_type = T;
+                using difference_type = std::ptrdiff_t;
+                using pointer = V*;
+                using reference = V&;
 
-        graph_root_ptr& operator=(const graph_root_ptr& other) {
-            if (&other != this) {
-                release();
-                this->ptr_graph_ = other.ptr_graph_;
-                this->v_ = other.v_;
-                grab();
-            }
-            return *this;
-        }
+                iterator_impl(S* s = nullptr, size_t i = 0) : slab_(s), index_(i) {
+                }
 
-        graph_root_ptr& operator=(graph_root_ptr&& other) noexcept {
-            if (&other != this) {
-                release();
-                this->ptr_graph_ = other.ptr_graph_;
-                this->v_ = other.v_;
-                other.wipe();
-            }
-            return *this;
-        }
+                reference operator*() const { return slab_->at(index_); }
+                pointer operator->() const { return &slab_->at(index_); }
 
-        const T* operator->() const { return get(); }
-        T* operator->() { return get(); }
-        T& operator*() { return *get(); }
-        const T& operator*()  const { return *get(); }
-        inline T* get();
-        inline const T* get() const;
-        explicit operator bool() const { return v_; }
+                iterator_impl& operator++() {
+                    ++index_;
+                    return *this;
+                }
 
-        void reset() {
-            release();
-            wipe();
-        }
+                iterator_impl operator++(int) {
+                    auto temp = *this;
+                    ++index_;
+                    return temp;
+                }
 
-        ~graph_root_ptr() {
-            release();
-        }
+                bool operator==(const iterator_impl& other) const { return index_ == other.index_; }
+                bool operator!=(const iterator_impl& other) const { return index_ != other.index_; }
 
-    private:
+            private:
+                S* slab_;
+                size_t index_;
+            };
 
-        using non_const_type = std::remove_const_t<T>;
+            static constexpr size_t compute_block_size() {
+                size_t n = 1;
+                while (n * 2 * sizeof(T) <= slab_block_bytes) {
+                    n *= 2;
+                }
+                return n;
+            }
 
-        void wipe() {
-            this->ptr_graph_ = nullptr;
-            this->v_ = 0;
-        }
+        public:
 
-        inline void release();
-        inline void grab();
+            static constexpr size_t block_size = compute_block_size();
 
-        graph_root_ptr(ptr_graph* gp, internal::obj_id_t v) : ptr_graph_(gp), v_(v) {
-            grab();
-        }
+            slab() : slab(0, nullptr, nullptr) {
+            }
 
-        internal::obj_id_t v_;
-        ptr_graph* ptr_graph_;
-    };
+            slab(size_t initial_capacity, should_collect_cb<T> sc, on_moved_cb<T> om) :
+                size_(0), reserved_blocks_((initial_capacity + block_size - 1) / block_size),
+                sweep_cursor_(0), sweep_end_(0), swept_(0), is_dead_(sc), on_moved_(om) {
+                while (blocks_.size() < reserved_blocks_) {
+                    add_block();
+                }
+            }
 
-    template<typename T>
-    class graph_ptr {
+            slab(const slab&) = delete;
+            slab& operator=(const slab&) = delete;
 
-        friend class ptr_graph;
-        template<typename U> friend class graph_root_ptr;
-        template<typename U> friend class graph_ptr;
-        template<typename U> friend class enable_self_ptr;
+            // the hole is taken before the constructor runs, since the constructor
+            // may make other objects, and they may sweep this slab.
+            template<typename... Args>
+            T* emplace(Args&&... args) {
+                if (!holes_.empty()) {
+                    T* hole = holes_.back();
+                    holes_.pop_back();
+                    try {
+                        return new (hole) T(std::forward<Args>(args)...);
+                    } catch (...) {
+                        holes_.push_back(hole);
+                        throw;
+                    }
+                }
+                if (size_ == capacity()) {
+                    add_block();
+                }
+                T* obj = new (slot(size_)) T(std::forward<Args>(args)...);
+                ++size_;
+                return obj;
+            }
 
-    public:
+            // runs the finalizer, if any, on a single object.
+            void finalize(T* obj) {
+                if (finalizer_) {
+                    finalizer_(&obj, 1);
+                }
+            }
 
-        using value_type = T;
+            // destroys obj where it is.
+            void erase(T* obj) {
+                obj->~T();
+                holes_.push_back(obj);
+            }
 
-        graph_ptr() :
-            u_{ 0 }, v_{ 0 }, ptr_graph_(nullptr)
+            // appends n objects copied bytewise from src and calls on_added on each.
+            // the copy is one memcpy per block.
+            template<typename F>
+            void append(const char* src, size_t n, F on_added) {
+                static_assert(std::is_trivially_copyable_v<T>);
+                reserve(n);
+                while (n > 0) {
+                    size_t count = std::min(n, block_size - size_ % block_size);
+                    std::memcpy(slot(size_), src, count * sizeof(T));
+                    for (size_t i = size_; i < size_ + count; ++i) {
+                        on_added(at(i));
+                    }
+                    size_ += count;
+                    src += count * sizeof(T);
+                    n -= count;
+                }
+            }
+
+            // runs the finalizer, if any, on the objects the next sweep will destroy.
+            void finalize() {
+                close_holes();
+                if (finalizer_) {
+                    finalize_dead({});
+                }
+            }
+
+            // starts a lazy sweep. the finalizer runs on the dead objects now, but
+            // they are left in place for sweep() to destroy a few at a time, in slot
+            // order. slots that are holes when the sweep starts are skipped, and
+            // slots below the sweep's position or past its end may be filled with
+            // new objects meanwhile, so the sweep never sees an object made after it
+            // started. nothing is compacted.
+            void begin_lazy_sweep() {
+                sweep_skip_ = find_holes();
+                sweep_cursor_ = 0;
+                sweep_end_ = size_;
+                if (finalizer_) {
+                    finalize_dead(sweep_skip_);
+                }
+            }
+
+            // checks up to n more slots of a lazy sweep, destroying the dead objects
+            // and leaving holes where they were. returns the number of slots checked,
+            // which is less than n only once the sweep is done. a destructor may
+            // sweep the same slab again, so each slot is claimed before it is checked.
+            size_t sweep(size_t n, on_swept_cb<T> on_swept) {
+                size_t checked = 0;
+                while (checked < n && sweep_cursor_ < sweep_end_) {
+                    size_t i = sweep_cursor_++;
+                    ++checked;
+                    if (!sweep_skip_.empty() && sweep_skip_[i])
+                        continue;
+                    T* obj = &at(i);
+                    if (!is_dead_(*obj))
+                        continue;
+                    on_swept(*obj);
+                    obj->~T();
+                    holes_.push_back(obj);
+                    ++swept_;
+                }
+                if (sweep_cursor_ == sweep_end_) {
+                    sweep_skip_ = {};
+                }
+                return checked;
+            }
+
+            // sweeps until a dead object's slot is free for emplace() to reuse, but
+            // checks at most lazy_sweep_step slots, so an allocation's share of the
+            // sweep stays bounded; if none is found the object goes at the end and
+            // the next allocation carries on from where this one stopped. returns
+            // the number destroyed.
+            size_t sweep_for_hole(on_swept_cb<T> on_swept) {
+                size_t swept = swept_;
+                for (size_t n = 0; n < lazy_sweep_step && holes_.empty() && sweep_cursor_ < sweep_end_; ++n) {
+                    sweep(1, on_swept);
+                }
+                return swept_ - swept;
+            }
+
+            // the number of objects destroyed by lazy sweeps since the last call.
+            size_t take_swept() {
+                return std::exchange(swept_, 0);
+            }
+
+            void set_finalizer(finalizer<T> f) {
+                finalizer_ = std::move(f);
+            }
+
+            // destroys the dead objects in slab order, threading the holes they leave
+            // into a list through the freed storage. survivors above the new size are
+            // then moved down into the holes below it. destructors of trivially
+            // destructible types do nothing, so for those the single pass front/back
+            // compaction below is used instead.
+            void collect() {
+                close_holes();
+                if constexpr (!std::is_trivially_destructible_v<T>) {
+                    static_assert(sizeof(storage_t) >= sizeof(size_t));
+                    constexpr size_t no_hole = std::numeric_limits<size_t>::max();
+
+                    size_t first_hole = no_hole;
+                    size_t last_hole = no_hole;
+                    size_t num_dead = 0;
+                    for (size_t i = 0; i < size_; ++i) {
+                        if (!is_dead_(at(i)))
+                            continue;
+                        destroy(i);
+                        if (last_hole == no_hole) {
+                            first_hole = i;
+                        } else {
+                            set_next_hole(last_hole, i);
+                        }
+                        last_hole = i;
+                        ++num_dead;
+                    }
+                    size_t new_size = size_ - num_dead;
+                    if (first_hole >= new_size) {
+                        // no holes below the new size, so nothing moves.
+                        size_ = new_size;
+                        release_empty_blocks();
+                        return;
+                    }
+                    set_next_hole(last_hole, no_hole);
+
+                    size_t low_hole = first_hole;
+                    size_t high_hole = first_hole;
+                    while (high_hole < new_size) {
+                        high_hole = next_hole(high_hole);
+                    }
+                    for (size_t i = new_size; i < size_; ++i) {
+                        if (i == high_hole) {
+                            high_hole = next_hole(high_hole);
+                            continue;
+                        }
+                        size_t hole = low_hole;
+                        low_hole = next_hole(hole);
+                        relocate(i, hole);
+                        on_moved_(at(hole));
+                    }
+                    size_ = new_size;
+                    release_empty_blocks();
+                    return;
+                }
+
+                size_t front = 0;
+                size_t back = size_;
+
+                while (front < back) {
+                    while (front < back && !is_dead_(at(front))) {
+                        ++front;
+                    }
+                    while (back > front && is_dead_(at(back - 1))) {
+                        destroy(--back);
+                    }
+                    if (front + 1 >= back)
+                        break;
+
+                    // front is dead and back - 1 is alive; move the survivor into the hole.
+                    destroy(front);
+                    new (slot(front)) T(std::move(at(back - 1)));
+                    destroy(--back);
+                    on_moved_(at(front++));
+                }
+
+                size_ = back;
+                release_empty_blocks();
+            }
+
+            // destroys the dead objects in slab order and then moves the survivors
+            // into fresh blocks sorted by key, so objects with nearby keys end up
+            // adjacent. the survivors briefly occupy both the old and new blocks.
+            void collect_in_order(order_key_cb<T> key) {
+                close_holes();
+                std::vector<std::pair<std::uint32_t, size_t>> order;
+                for (size_t i = 0; i < size_; ++i) {
+                    if (is_dead_(at(i))) {
+                        destroy(i);
+                    } else {
+                        order.emplace_back(key(at(i)), i);
+                    }
+                }
+                std::sort(order.begin(), order.end());
+
+                std::vector<std::unique_ptr<storage_t[]>> old_blocks;
+                old_blocks.swap(blocks_);
+                size_ = 0;
+                while (blocks_.size() < std::max(reserved_blocks_, (order.size() + block_size - 1) / block_size)) {
+                    add_block();
+                }
+                for (const auto& [k, i] : order) {
+                    T& obj = *std::launder(reinterpret_cast<T*>(&old_blocks[i / block_size][i % block_size]));
+                    new (slot(size_++)) T(std::move(obj));
+                    obj.~T();
+                }
+                for (size_t i = 0; i < size_; ++i) {
+                    on_moved_(at(i));
+                }
+            }
+
+            // stable single pass sweep. dead objects are destroyed, objects for which
+            // extract() returns true are removed (extract() is expected to have moved
+            // them elsewhere), and the rest are slid toward the front in order.
+            template<typename Extract>
+            void collect_extracting(Extract extract) {
+                close_holes();
+                size_t dest = 0;
+                for (size_t i = 0; i < size_; ++i) {
+                    if (is_dead_(at(i)) || extract(at(i))) {
+                        destroy(i);
+                        continue;
+                    }
+                    if (i != dest) {
+                        relocate(i, dest);
+                        on_moved_(at(dest));
+                    }
+                    ++dest;
+                }
+                size_ = dest;
+                release_empty_blocks();
+            }
+
+            // parallel sweep: the slab is split into ranges that are compacted
+            // concurrently, the compacted ranges are then slid down into one run, and
+            // finally on_moved is called for every survivor. unlike collect() this
+            // preserves the relative order of survivors.
+            void collect(size_t num_threads) {
+                close_holes();
+                size_t num_ranges = std::min(num_threads, size_ / parallel_sweep_min_range);
+                if (num_ranges < 2) {
+                    collect();
+                    return;
+                }
+
+                auto range_start = [&](size_t r) { return size_ * r / num_ranges; };
+                std::vector<size_t> num_alive(num_ranges);
+                run_parallel(num_ranges,
+                    [&](size_t r) {
+                        num_alive[r] = compact_range(range_start(r), range_start(r + 1));
+                    }
+                );
+
+                size_t dest = num_alive[0];
+                for (size_t r = 1; r < num_ranges; ++r) {
+                    size_t src = range_start(r);
+                    for (size_t i = 0; i < num_alive[r]; ++i, ++dest) {
+                        if (src + i != dest) {
+                            relocate(src + i, dest);
+                        }
+                    }
+                }
+                size_ = dest;
+
+                run_parallel(num_ranges,
+                    [&](size_t r) {
+                        for (size_t i = range_start(r); i < range_start(r + 1); ++i) {
+                            on_moved_(at(i));
+                        }
+                    }
+                );
+                release_empty_blocks();
+            }
+
+            size_t size() const {
+                return size_ - holes_.size();
+            }
+
+            template<typename F>
+            void for_each(F f) const {
+                auto is_hole = find_holes();
+                for (size_t i = 0; i < size_; ++i) {
+                    if (is_hole.empty() || !is_hole[i]) {
+                        f(at(i));
+                    }
+                }
+            }
+
+            size_t capacity() const {
+                return blocks_.size() * block_size;
+            }
+
+            // makes room for n more objects.
+            void reserve(size_t n) {
+                while (capacity() < size_ + n) {
+                    add_block();
+                }
+            }
+
+            // frees every block not holding objects, including the initially
+            // reserved ones.
+            void shrink_to_fit() {
+                reserved_blocks_ = 0;
+                release_empty_blocks();
+                blocks_.shrink_to_fit();
+            }
+
+            size_t memory_usage() const {
+                return blocks_.size() * block_size * sizeof(storage_t) +
+                    blocks_.capacity() * sizeof(blocks_[0]);
+            }
+
+            T& at(size_t i) {
+                return *std::launder(reinterpret_cast<T*>(slot(i)));
+            }
+
+            const T& at(size_t i) const {
+                return *std::launder(reinterpret_cast<const T*>(slot(i)));
+            }
+
+            using iterator = iterator_impl<slab, T>;
+            using const_iterator = iterator_impl<const slab, const T>;
+
+            iterator begin() {
+                return iterator(this, 0);
+            }
+
+            iterator end() {
+                return iterator(this, size_);
+            }
+
+            const_iterator begin() const {
+                return const_iterator(this, 0);
+            }
+
+            const_iterator end() const {
+                return const_iterator(this, size_);
+            }
+
+            ~slab() {
+                if (holes_.size() == size_)
+                    return;
+                auto is_hole = find_holes();
+                for (size_t i = 0; i < size_; ++i) {
+                    if (is_hole.empty() || !is_hole[i]) {
+                        destroy(i);
+                    }
+                }
+            }
+
+        private:
+
+            using storage_t = std::aligned_storage_t<sizeof(T), alignof(T)>;
+
+            void* slot(size_t i) {
+                return &blocks_[i / block_size][i % block_size];
+            }
+
+            const void* slot(size_t i) const {
+                return &blocks_[i / block_size][i % block_size];
+            }
+
+            void destroy(size_t i) {
+                at(i).~T();
+            }
+
+            size_t next_hole(size_t hole) const {
+                size_t next;
+                std::memcpy(&next, slot(hole), sizeof(next));
+                return next;
+            }
+
+            void set_next_hole(size_t hole, size_t next) {
+                std::memcpy(slot(hole), &next, sizeof(next));
+            }
+
+            void relocate(size_t from, size_t to) {
+                if constexpr (std::is_trivially_copyable_v<T>) {
+                    std::memcpy(slot(to), slot(from), sizeof(T));
+                } else {
+                    new (slot(to)) T(std::move(at(from)));
+                    destroy(from);
+                }
+            }
+
+            // flags the slots that are holes left by erase(), or returns an empty
+            // vector if there are none.
+            std::vector<bool> find_holes() const {
+                if (holes_.empty())
+                    return {};
+                std::less<const storage_t*> before;
+                std::vector<std::pair<const storage_t*, size_t>> blocks;
+                blocks.reserve(blocks_.size());
+                for (size_t b = 0; b < blocks_.size(); ++b) {
+                    blocks.emplace_back(blocks_[b].get(), b);
+                }
+                std::sort(blocks.begin(), blocks.end(),
+                    [&](const auto& x, const auto& y) { return before(x.first, y.first); });
+
+                std::vector<bool> is_hole(size_, false);
+                for (const T* hole : holes_) {
+                    auto p = reinterpret_cast<const storage_t*>(hole);
+                    auto block = std::upper_bound(blocks.begin(), blocks.end(), p,
+                        [&](const storage_t* q, const auto& b) { return before(q, b.first); }
+                    ) - 1;
+                    is_hole[block->second * block_size + static_cast<size_t>(p - block->first)] = true;
+                }
+                return is_hole;
+            }
+
+            // moves the last objects of the slab into the holes below them.
+            void close_holes() {
+                if (holes_.empty())
+                    return;
+                auto is_hole = find_holes();
+                size_t new_size = size_ - holes_.size();
+                size_t back = size_;
+                for (size_t i = 0; i < new_size; ++i) {
+                    if (!is_hole[i])
+                        continue;
+                    do {
+                        --back;
+                    } while (is_hole[back]);
+                    relocate(back, i);
+                    on_moved_(at(i));
+                }
+                holes_.clear();
+                size_ = new_size;
+                release_empty_blocks();
+            }
+
+            // passes the finalizer every dead object that is not a hole.
+            void finalize_dead(const std::vector<bool>& is_hole) {
+                std::vector<T*> dead;
+                for (size_t i = 0; i < size_; ++i) {
+                    if (!is_hole.empty() && is_hole[i])
+                        continue;
+                    if (is_dead_(at(i))) {
+                        dead.push_back(&at(i));
+                    }
+                }
+                if (!dead.empty()) {
+                    finalizer_(dead.data(), dead.size());
+                }
+            }
+
+            // stable in place compaction of [first, last) that does not call on_moved.
+            // returns the number of survivors, which end up in [first, first + n).
+            size_t compact_range(size_t first, size_t last) {
+                size_t dest = first;
+                for (size_t i = first; i < last; ++i) {
+                    if (is_dead_(at(i))) {
+                        destroy(i);
+                    } else {
+                        if (i != dest) {
+                            relocate(i, dest);
+                        }
+                        ++dest;
+                    }
+                }
+                return dest - first;
+            }
+
+            // the storage is left uninitialized; make_unique would zero the block.
+            void add_block() {
+                blocks_.push_back(std::unique_ptr<storage_t[]>(new storage_t[block_size]));
+            }
+
+            void release_empty_blocks() {
+                size_t needed = std::max((size_ + block_size - 1) / block_size, reserved_blocks_);
+                if (blocks_.size() > needed) {
+                    blocks_.resize(needed);
+                }
+            }
+
+            std::vector<std::unique_ptr<storage_t[]>> blocks_;
+            std::vector<T*> holes_;
+            size_t size_;
+            size_t reserved_blocks_;
+            std::vector<bool> sweep_skip_;
+            size_t sweep_cursor_;
+            size_t sweep_end_;
+            size_t swept_;
+            should_collect_cb<T> is_dead_;
+            on_moved_cb<T> on_moved_;
+            finalizer<T> finalizer_;
+        };
+
+        // the objects of one type. new objects go into the nursery when the store is
+        // generational and into the tenured slab otherwise. a minor collection sweeps
+        // only the nursery, moving objects that have survived long enough into the
+        // tenured slab.
+        template<typename T>
+        class slab_set {
+        public:
+            slab_set(size_t initial_capacity, should_collect_cb<T> is_dead_fn,
+                    on_moved_cb<T> on_moved_fn, on_survived_cb<T> on_survived_fn,
+                    order_key_cb<T> order_key_fn, on_swept_cb<T> on_swept_fn) :
+                nursery_(0, is_dead_fn, on_moved_fn),
+                tenured_(initial_capacity, is_dead_fn, on_moved_fn),
+                on_moved_(on_moved_fn),
+                on_survived_(on_survived_fn),
+                order_key_(order_key_fn),
+                on_swept_(on_swept_fn) {
+            }
+
+            template<typename... Args>
+            T* emplace(bool young, Args&&... args) {
+                return (young ? nursery_ : tenured_).emplace(std::forward<Args>(args)...);
+            }
+
+            void reserve(bool young, size_t n) {
+                (young ? nursery_ : tenured_).reserve(n);
+            }
+
+            template<typename F>
+            void append(const char* src, size_t n, F on_added) {
+                tenured_.append(src, n, on_added);
+            }
+
+            void finalize(T* obj, bool young) {
+                (young ? nursery_ : tenured_).finalize(obj);
+            }
+
+            void erase(T* obj, bool young) {
+                (young ? nursery_ : tenured_).erase(obj);
+            }
+
+            template<typename F>
+            void for_each(F f) const {
+                nursery_.for_each(f);
+                tenured_.for_each(f);
+            }
+
+            void set_finalizer(const finalizer<T>& f) {
+                nursery_.set_finalizer(f);
+                tenured_.set_finalizer(f);
+            }
+
+            void finalize(bool nursery_only) {
+                nursery_.finalize();
+                if (!nursery_only) {
+                    tenured_.finalize();
+                }
+            }
+
+            void collect(size_t num_threads) {
+                nursery_.collect(num_threads);
+                tenured_.collect(num_threads);
+            }
+
+            void collect_in_order() {
+                nursery_.collect_in_order(order_key_);
+                tenured_.collect_in_order(order_key_);
+            }
+
+            void begin_lazy_sweep() {
+                nursery_.begin_lazy_sweep();
+                tenured_.begin_lazy_sweep();
+            }
+
+            size_t sweep(size_t n) {
+                size_t checked = tenured_.sweep(n, on_swept_);
+                return checked + nursery_.sweep(n - checked, on_swept_);
+            }
+
+            size_t sweep_for_hole(bool young) {
+                return (young ? nursery_ : tenured_).sweep_for_hole(on_swept_);
+            }
+
+            size_t take_swept() {
+                return nursery_.take_swept() + tenured_.take_swept();
+            }
+
+            void collect_nursery(size_t promotion_age) {
+                nursery_.collect_extracting(
+                    [&](T& obj) {
+                        if (!on_survived_(obj, promotion_age))
+                            return false;
+                        on_moved_(*tenured_.emplace(std::move(obj)));
+                        return true;
+                    }
+                );
+            }
+
+            size_t size() const {
+                return nursery_.size() + tenured_.size();
+            }
+
+            void shrink_to_fit() {
+                nursery_.shrink_to_fit();
+                tenured_.shrink_to_fit();
+            }
+
+            size_t memory_usage() const {
+                return nursery_.memory_usage() + tenured_.memory_usage();
+            }
+
+        private:
+            slab<T> nursery_;
+            slab<T> tenured_;
+            on_moved_cb<T> on_moved_;
+            on_survived_cb<T> on_survived_;
+            order_key_cb<T> order_key_;
+            on_swept_cb<T> on_swept_;
+        };
+
+        // the type erased operations of a slab_set<T>. there is one constant table
+        // per T, so dispatch is a single indirect call and nothing is allocated.
+        struct slab_vtable {
+            void (*destroy)(void* slab);
+            // sweeps both generations; with num_threads > 1 large slabs are split
+            // into ranges swept in parallel.
+            void (*collect)(void* slab, size_t num_threads);
+            void (*collect_in_order)(void* slab);
+            void (*collect_nursery)(void* slab, size_t promotion_age);
+            void (*finalize_one)(void* slab, void* obj, bool young);
+            void (*erase)(void* slab, void* obj, bool young);
+            void (*finalize)(void* slab, bool nursery_only);
+            void (*begin_lazy_sweep)(void* slab);
+            size_t (*sweep)(void* slab, size_t n);
+            size_t (*take_swept)(void* slab);
+            size_t (*size)(const void* slab);
+            size_t (*memory_usage)(const void* slab);
+            void (*shrink_to_fit)(void* slab);
+            size_t object_size;
+        };
+
+        template<typename T>
+        inline constexpr slab_vtable slab_vtable_for = {
+            [](void* slab) {
+                delete static_cast<slab_set<T>*>(slab);
+            },
+            [](void* slab, size_t num_threads) {
+                static_cast<slab_set<T>*>(slab)->collect(num_threads);
+            },
+            [](void* slab) {
+                static_cast<slab_set<T>*>(slab)->collect_in_order();
+            },
+            [](void* slab, size_t promotion_age) {
+                static_cast<slab_set<T>*>(slab)->collect_nursery(promotion_age);
+            },
+            [](void* slab, void* obj, bool young) {
+                static_cast<slab_set<T>*>(slab)->finalize(static_cast<T*>(obj), young);
+            },
+            [](void* slab, void* obj, bool young) {
+                static_cast<slab_set<T>*>(slab)->erase(static_cast<T*>(obj), young);
+            },
+            [](void* slab, bool nursery_only) {
+                static_cast<slab_set<T>*>(slab)->finalize(nursery_only);
+            },
+            [](void* slab) {
+                static_cast<slab_set<T>*>(slab)->begin_lazy_sweep();
+            },
+            [](void* slab, size_t n) {
+                return static_cast<slab_set<T>*>(slab)->sweep(n);
+            },
+            [](void* slab) {
+                return static_cast<slab_set<T>*>(slab)->take_swept();
+            },
+            [](const void* slab) {
+                return static_cast<const slab_set<T>*>(slab)->size();
+            },
+            [](const void* slab) {
+                return static_cast<const slab_set<T>*>(slab)->memory_usage();
+            },
+            [](void* slab) {
+                static_cast<slab_set<T>*>(slab)->shrink_to_fit();
+            },
+            sizeof(T)
+        };
+
+        // owns a slab_set of some type. the number of objects is cached here so
+        // that summing sizes across slabs does not dispatch.
+        class any_slab {
+        public:
+
+            any_slab(const any_slab& os) = delete;
+            any_slab(any_slab&& os) noexcept : slab_(os.slab_), vtable_(os.vtable_), size_(os.size_) {
+                os.slab_ = nullptr;
+            }
+            any_slab& operator=(const any_slab& os) = delete;
+            any_slab& operator=(any_slab&& os) noexcept {
+                if (&os != this) {
+                    release();
+                    slab_ = os.slab_;
+                    vtable_ = os.vtable_;
+                    size_ = os.size_;
+                    os.slab_ = nullptr;
+                }
+                return *this;
+            }
+
+            template<typename T>
+            any_slab(size_t initial_capacity, should_collect_cb<T> is_dead_fn,
+                    on_moved_cb<T> on_moved_fn, on_survived_cb<T> on_survived_fn,
+                    order_key_cb<T> order_key_fn, on_swept_cb<T> on_swept_fn) :
+                slab_(
+                    new slab_set<T>(initial_capacity, is_dead_fn, on_moved_fn, on_survived_fn,
+                        order_key_fn, on_swept_fn)
+                ),
+                vtable_(&slab_vtable_for<T>),
+                size_(0)
+            { }
+
+            // during a lazy sweep, a dead object's slot is reused if one can be found.
+            template<typename T, typename... Args>
+            T* emplace(bool young, Args&&... args) {
+                slab_set<T>* slab_ptr = static_cast<slab_set<T>*>(slab_);
+                size_ -= slab_ptr->sweep_for_hole(young);
+                T* obj = slab_ptr->emplace(young, std::forward<Args>(args)...);
+                ++size_;
+                return obj;
+            }
+
+            template<typename T>
+            void reserve(bool young, size_t n) {
+                static_cast<slab_set<T>*>(slab_)->reserve(young, n);
+            }
+
+            template<typename T, typename F>
+            void append(const char* src, size_t n, F on_added) {
+                static_cast<slab_set<T>*>(slab_)->append(src, n, on_added);
+                size_ += n;
+            }
+
+            template<typename T, typename F>
+            void for_each(F f) const {
+                static_cast<const slab_set<T>*>(slab_)->for_each(f);
+            }
+
+            template<typename T>
+            void set_finalizer(const finalizer<T>& f) {
+                static_cast<slab_set<T>*>(slab_)->set_finalizer(f);
+            }
+
+            void finalize(void* obj, bool young) {
+                vtable_->finalize_one(slab_, obj, young);
+            }
+
+            void erase(void* obj, bool young) {
+                vtable_->erase(slab_, obj, young);
+                --size_;
+            }
+
+            void finalize(bool nursery_only) {
+                vtable_->finalize(slab_, nursery_only);
+            }
+
+            void collect(size_t num_threads = 1) {
+                vtable_->collect(slab_, num_threads);
+                size_ = vtable_->size(slab_);
+            }
+
+            void begin_lazy_sweep() {
+                vtable_->begin_lazy_sweep(slab_);
+            }
+
+            size_t sweep(size_t n) {
+                size_t checked = vtable_->sweep(slab_, n);
+                if (checked > 0) {
+                    size_ = vtable_->size(slab_);
+                }
+                return checked;
+            }
+
+            size_t take_swept() {
+                return vtable_->take_swept(slab_);
+            }
+
+            void collect_in_order() {
+                vtable_->collect_in_order(slab_);
+                size_ = vtable_->size(slab_);
+            }
+
+            void collect_nursery(size_t promotion_age) {
+                vtable_->collect_nursery(slab_, promotion_age);
+                size_ = vtable_->size(slab_);
+            }
+
+            void shrink_to_fit() {
+                vtable_->shrink_to_fit(slab_);
+            }
+
+            size_t size() const {
+                return size_;
+            }
+
+            size_t memory_usage() const {
+                return vtable_->memory_usage(slab_);
+            }
+
+            size_t object_size() const {
+                return vtable_->object_size;
+            }
+
+            ~any_slab() {
+                release();
+            }
+
+        private:
+
+            void release() {
+                if (slab_) {
+                    vtable_->destroy(slab_);
+                    slab_ = nullptr;
+                }
+            }
+
+            void* slab_;
+            const slab_vtable* vtable_;
+            size_t size_;
+        };
+
+        // the shared half of a parallel marker's work: the owning worker pushes and
+        // pops at the back, other workers steal from the front.
+        class mark_queue {
+        public:
+            template<typename Iter>
+            void push(Iter first, Iter last) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                items_.insert(items_.end(), first, last);
+            }
+
+            bool pop(obj_id_t& id) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (items_.empty())
+                    return false;
+                id = items_.back();
+                items_.pop_back();
+                return true;
+            }
+
+            bool steal(obj_id_t& id) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (items_.empty())
+                    return false;
+                id = items_.front();
+                items_.pop_front();
+                return true;
+            }
+
+        private:
+            std::mutex mutex_;
+            std::deque<obj_id_t> items_;
+        };
+
+        // multiset of edge targets held as (target, count) pairs. the first few
+        // distinct targets are stored inline so low degree cells never allocate; past
+        // that the entries spill to an open addressing hash table with linear probing,
+        // which keeps high degree cells such as the root cell O(1) per edge. either
+        // way iteration walks contiguous memory. target 0 never occurs because
+        // nothing can point at the root cell, so it marks an empty table slot.
+        class edge_list {
+        public:
+            static constexpr std::uint32_t inline_capacity = 3;
+            static constexpr std::uint32_t initial_table_capacity = 16;
+
+            struct entry {
+                obj_id_t target;
+                size_t count;
+            };
+
+            class const_iterator {
+            public:
+                using iterator_category = std::forward_iterator_tag;
+                using value_type = entry;
+                using difference_type = std::ptrdiff_t;
+                using pointer = const entry*;
+                using reference = const entry&;
+
+                const_iterator(const entry* e, const entry* end) : e_(e), end_(end) {
+                    skip_empty();
+                }
+
+                reference operator*() const { return *e_; }
+                pointer operator->() const { return e_; }
+
+                const_iterator& operator++() {
+                    ++e_;
+                    skip_empty();
+                    return *this;
+                }
+
+                bool operator==(const const_iterator& other) const { return e_ == other.e_; }
+                bool operator!=(const const_iterator& other) const { return e_ != other.e_; }
+
+            private:
+                void skip_empty() {
+                    while (e_ != end_ && e_->target == 0) {
+                        ++e_;
+                    }
+                }
+
+                const entry* e_;
+                const entry* end_;
+            };
+
+            using allocator_type = std::pmr::polymorphic_allocator<entry>;
+
+            explicit edge_list(const allocator_type& alloc = {}) :
+                alloc_(alloc), table_(nullptr), size_(0), capacity_(0) {
+            }
+
+            edge_list(const edge_list&) = delete;
+            edge_list& operator=(const edge_list&) = delete;
+
+            ~edge_list() {
+                free_table(table_, capacity_);
+            }
+
+            void add(obj_id_t target, size_t count = 1) {
+                if (entry* e = find(target)) {
+                    e->count += count;
+                    return;
+                }
+                if (!table_) {
+                    if (size_ < inline_capacity) {
+                        inline_[size_++] = { target, count };
+                        return;
+                    }
+                    rehash(initial_table_capacity);
+                } else if (4 * (size_ + 1) > 3 * capacity_) {
+                    rehash(2 * capacity_);
+                }
+                *probe(target) = { target, count };
+                ++size_;
+            }
+
+            void remove(obj_id_t target, size_t count = 1) {
+                entry* e = find(target);
+                e->count -= count;
+                if (e->count > 0)
+                    return;
+                if (table_) {
+                    erase_from_table(e);
+                } else {
+                    *e = inline_[size_ - 1];
+                }
+                --size_;
+            }
+
+            // makes room for n distinct targets in total without rehashing.
+            void reserve(size_t n) {
+                if (n <= inline_capacity)
+                    return;
+                std::uint32_t new_capacity = initial_table_capacity;
+                while (3 * static_cast<size_t>(new_capacity) < 4 * n) {
+                    new_capacity *= 2;
+                }
+                if (new_capacity > capacity_) {
+                    rehash(new_capacity);
+                }
+            }
+
+            entry* find(obj_id_t target) {
+                if (!table_) {
+                    for (std::uint32_t i = 0; i < size_; ++i) {
+                        if (inline_[i].target == target)
+                            return &inline_[i];
+                    }
+                    return nullptr;
+                }
+                entry* e = probe(target);
+                return (e->target == target) ? e : nullptr;
+            }
+
+            void clear() {
+                free_table(table_, capacity_);
+                table_ = nullptr;
+                size_ = 0;
+                capacity_ = 0;
+            }
+
+            size_t size() const {
+                return size_;
+            }
+
+            bool empty() const {
+                return size_ == 0;
+            }
+
+            const_iterator begin() const {
+                return table_ ?
+                    const_iterator(table_, table_ + capacity_) :
+                    const_iterator(inline_, inline_ + size_);
+            }
+
+            const_iterator end() const {
+                const entry* last = table_ ? table_ + capacity_ : inline_ + size_;
+                return const_iterator(last, last);
+            }
+
+        private:
+
+            std::uint32_t home(obj_id_t target) const {
+                return static_cast<std::uint32_t>(
+                    (target * 0x9E3779B97F4A7C15ull) >> (64 - floor_log2(capacity_))
+                );
+            }
+
+            // returns the slot holding target, or the empty slot where it would go.
+            entry* probe(obj_id_t target) {
+                std::uint32_t mask = capacity_ - 1;
+                for (std::uint32_t i = home(target);; i = (i + 1) & mask) {
+                    if (table_[i].target == target || table_[i].target == 0)
+                        return &table_[i];
+                }
+            }
+
+            void rehash(std::uint32_t new_capacity) {
+                entry* old_entries = table_ ? table_ : inline_;
+                std::uint32_t old_capacity = table_ ? capacity_ : size_;
+
+                entry* old_table = table_;
+                table_ = alloc_.allocate(new_capacity);
+                std::uninitialized_fill_n(table_, new_capacity, entry{ 0, 0 });
+                capacity_ = new_capacity;
+                for (std::uint32_t i = 0; i < old_capacity; ++i) {
+                    if (old_entries[i].target != 0) {
+                        *probe(old_entries[i].target) = old_entries[i];
+                    }
+                }
+                free_table(old_table, old_capacity);
+            }
+
+            void free_table(entry* table, std::uint32_t capacity) {
+                if (table) {
+                    alloc_.deallocate(table, capacity);
+                }
+            }
+
+            // backward shift deletion, so no tombstones are needed.
+            void erase_from_table(entry* e) {
+                std::uint32_t mask = capacity_ - 1;
+                std::uint32_t hole = static_cast<std::uint32_t>(e - table_);
+                for (std::uint32_t i = (hole + 1) & mask; table_[i].target != 0; i = (i + 1) & mask) {
+                    std::uint32_t h = home(table_[i].target);
+                    bool movable = (hole <= i) ? (h <= hole || h > i) : (h <= hole && h > i);
+                    if (movable) {
+                        table_[hole] = table_[i];
+                        hole = i;
+                    }
+                }
+                table_[hole].target = 0;
+            }
+
+            allocator_type alloc_;
+            entry inline_[inline_capacity];
+            entry* table_;
+            std::uint32_t size_;
+            std::uint32_t capacity_;
+        };
+
+        inline size_t next_type_slot() {
+            static std::atomic<size_t> next(0);
+            return next++;
+        }
+
+        // a small dense index identifying T, assigned the first time it is asked for.
+        template<typename T>
+        size_t type_slot() {
+            static const size_t slot = next_type_slot();
+            return slot;
+        }
+
+        // selects the pointer constructors that take over an edge already inserted
+        // into the graph rather than inserting one.
+        struct adopt_edge_t {
+        };
+
+        struct ptr_graph_cell {
+            void* value;
+            std::uint32_t generation;
+            bool gc_mark;
+            bool in_use;
+            bool tenured;
+            bool remembered;
+            // set while collect_from() destroys the cell's object.
+            bool dying;
+            std::uint8_t age;
+            std::uint32_t mark_order;
+            // edges into the cell, kept only in reference counting mode.
+            std::uint32_t in_degree;
+            std::uint32_t type_slot;
+            edge_list adj_list;
+
+            using allocator_type = edge_list::allocator_type;
+
+            ptr_graph_cell(void* value = nullptr) :
+                value(value), generation(0), gc_mark(false), in_use(false),
+                tenured(true), remembered(false), dying(false), age(0), mark_order(0),
+                in_degree(0), type_slot(0)
+            {}
+
+            explicit ptr_graph_cell(const allocator_type& alloc) :
+                value(nullptr), generation(0), gc_mark(false), in_use(false),
+                tenured(true), remembered(false), dying(false), age(0), mark_order(0),
+                in_degree(0), type_slot(0), adj_list(alloc)
+            {}
+
+            // set once the marker has scanned the cell's edges, so that when marking
+            // is done it tells whether the cell survives. whether a cell has been
+            // shaded at all is kept in the graph's mark bitmap.
+            bool is_marked() const {
+                return gc_mark;
+            }
+
+            void set_mark(bool mark) {
+                gc_mark = mark;
+            }
+        };
+
+        // the object comes first, so a cell is at the address of its object.
+        template<typename T>
+        struct obj_store_cell {
+            T value;
+            ptr_graph_cell* graph_cell_ptr;
+
+            obj_store_cell() : graph_cell_ptr(nullptr) {
+            }
+
+            template<typename... Args>
+            obj_store_cell(Args&&... args) :
+                value(std::forward<Args>(args)...),
+                graph_cell_ptr(nullptr) {
+            }
+        };
+
+        class graph_obj_store {
+
+
+        public:
+
+            graph_obj_store(size_t initial_capacity) :
+                initial_capacity_(initial_capacity), generational_(false),
+                live_bytes_(0), allocated_bytes_(0), sweep_slot_(0) {
+            }
+
+            void set_generational(bool generational) {
+                generational_ = generational;
+            }
+
+            template<typename T, typename... Args>
+            obj_store_cell<T>* emplace(Args&&... args) {
+                any_slab* objs = &slab_for<T>();
+                allocated_bytes_.fetch_add(sizeof(obj_store_cell<T>), std::memory_order_relaxed);
+                obj_store_cell<T>* new_slab_item_ptr = objs->emplace<obj_store_cell<T>>(generational_, std::forward<Args>(args)...);
+                return new_slab_item_ptr;
+            }
+
+            // loaded objects go straight to the tenured generation.
+            template<typename T, typename... Args>
+            obj_store_cell<T>* emplace_tenured(Args&&... args) {
+                allocated_bytes_.fetch_add(sizeof(obj_store_cell<T>), std::memory_order_relaxed);
+                return slab_for<T>().template emplace<obj_store_cell<T>>(false, std::forward<Args>(args)...);
+            }
+
+            // copies n cells of a trivially copyable T from src into the tenured
+            // generation, calling on_added on each.
+            template<typename T, typename F>
+            void append(const char* src, size_t n, F on_added) {
+                allocated_bytes_.fetch_add(n * sizeof(obj_store_cell<T>), std::memory_order_relaxed);
+                slab_for<T>().template append<obj_store_cell<T>>(src, n, on_added);
+            }
+
+            // these act on the single object at value, which is of the type with the
+            // given type slot. erase() destroys it without moving any other object.
+            void finalize(size_t slot, void* value, bool young) {
+                slabs_by_slot_[slot]->finalize(value, young);
+            }
+
+            void erase(size_t slot, void* value, bool young) {
+                slabs_by_slot_[slot]->erase(value, young);
+            }
+
+            std::type_index type_of(size_t slot) const {
+                return types_by_slot_[slot];
+            }
+
+            size_t object_size(size_t slot) const {
+                return slabs_by_slot_[slot]->object_size();
+            }
+
+            template<typename T, typename F>
+            void for_each(F f) const {
+                size_t slot = type_slot<T>();
+                if (slot < slabs_by_slot_.size() && slabs_by_slot_[slot]) {
+                    slabs_by_slot_[slot]->template for_each<obj_store_cell<T>>(f);
+                }
+            }
+
+            template<typename T>
+            void set_finalizer(finalizer<T> f) {
+                finalizer<obj_store_cell<T>> cell_finalizer;
+                if (f) {
+                    cell_finalizer = [f = std::move(f)](obj_store_cell<T>* const* cells, size_t count) {
+                        std::vector<T*> objs(count);
+                        for (size_t i = 0; i < count; ++i) {
+                            objs[i] = &cells[i]->value;
+                        }
+                        f(objs.data(), count);
+                    };
+                }
+                slab_for<T>().set_finalizer(cell_finalizer);
+            }
+
+            // makes room for n more objects of type T.
+            template<typename T>
+            void reserve(size_t n) {
+                slab_for<T>().template reserve<obj_store_cell<T>>(generational_, n);
+            }
+
+            size_t size() const {
+                size_t sz = 0;
+
+                for (const auto& [key, val] : type_to_slab_) {
+                    sz += val.size();
+                }
+
+                return sz;
+            }
+
+            // bytes reserved for objects, including unused slab capacity.
+            size_t memory_usage() const {
+                size_t bytes = 0;
+                for (const auto& [key, val] : type_to_slab_) {
+                    bytes += val.memory_usage();
+                }
+                return bytes;
+            }
+
+            void shrink_to_fit() {
+                for (auto& [key, val] : type_to_slab_) {
+                    val.shrink_to_fit();
+                }
+            }
+
+            // bytes of objects that survived the last collection.
+            size_t live_bytes() const {
+                return live_bytes_.load(std::memory_order_relaxed);
+            }
+
+            // bytes of objects allocated since the last collection.
+            size_t allocated_bytes() const {
+                return allocated_bytes_.load(std::memory_order_relaxed);
+            }
+
+            // with num_threads > 1, slabs large enough to split are swept one after
+            // another using all the threads, and the remaining slabs are swept
+            // concurrently, one slab per thread at a time.
+            // finalizers of every type run before any object is destroyed. with
+            // in_traversal_order the survivors of each type are laid out in the order
+            // the marker reached them.
+            void collect(size_t num_threads, bool in_traversal_order, type_heap_stats_map& types) {
+                count_objects(types);
+                for (auto& [key, val] : type_to_slab_) {
+                    val.finalize(false);
+                }
+                if (in_traversal_order) {
+                    for (auto& [key, val] : type_to_slab_) {
+                        val.collect_in_order();
+                    }
+                } else {
+                    sweep_slabs(num_threads);
+                }
+                record_freed(types);
+                reset_byte_counts();
+            }
+
+            // starts a sweep that is done later, by sweep() and by emplace() looking for
+            // a free slot. finalizers of every type run now, on all the dead objects.
+            void begin_lazy_sweep(type_heap_stats_map& types) {
+                count_objects(types);
+                for (auto& [key, val] : type_to_slab_) {
+                    val.begin_lazy_sweep();
+                }
+                record_freed(types);
+                reset_byte_counts();
+                sweep_slot_ = 0;
+            }
+
+            // checks up to budget more objects of a lazy sweep, one slab after
+            // another, taking what it checks off budget. returns true once every
+            // slab has been swept.
+            bool sweep(size_t& budget) {
+                for (; sweep_slot_ < slabs_by_slot_.size(); ++sweep_slot_) {
+                    if (any_slab* objs = slabs_by_slot_[sweep_slot_]) {
+                        budget -= objs->sweep(budget);
+                        if (budget == 0)
+                            return false;
+                    }
+                }
+                return true;
+            }
+
+            // adds what lazy sweeps destroyed since the last call to types, and
+            // updates the live counts.
+            void record_swept(type_heap_stats_map& types) {
+                size_t bytes = 0;
+                for (auto& [key, val] : type_to_slab_) {
+                    auto& stats = types[key];
+                    size_t swept = val.take_swept();
+                    stats.freed_objects += swept;
+                    stats.freed_bytes += swept * val.object_size();
+                    stats.live_objects = val.size();
+                    stats.live_bytes = stats.live_objects * val.object_size();
+                    bytes += swept * val.object_size();
+                }
+                live_bytes_.fetch_sub(bytes, std::memory_order_relaxed);
+            }
+
+            void collect_nurseries(size_t promotion_age, type_heap_stats_map& types) {
+                count_objects(types);
+                for (auto& [key, val] : type_to_slab_) {
+                    val.finalize(true);
+                }
+                for (auto& [key, val] : type_to_slab_) {
+                    val.collect_nursery(promotion_age);
+                }
+                record_freed(types);
+                reset_byte_counts();
+            }
+
+        private:
+
+            template<typename T>
+            any_slab& slab_for() {
+                size_t slot = type_slot<T>();
+                any_slab* objs = (slot < slabs_by_slot_.size()) ? slabs_by_slot_[slot] : nullptr;
+                return objs ? *objs : add_slab<T>(slot);
+            }
+
+            // the slab for T is found by T's type slot, an index handed out once per
+            // type per process, so emplace does not hash. slabs are owned by
+            // type_to_slab_, whose elements never move.
+            template<typename T>
+            any_slab& add_slab(size_t slot) {
+                auto [iter, success] = type_to_slab_.insert(
+                    std::pair<std::type_index, any_slab>(
+                        std::type_index(typeid(T)),
+                        any_slab(
+                            initial_capacity_,
+                            should_collect_cb< obj_store_cell<T>>(
+                                [](const obj_store_cell<T>& si) {
+                                    return !si.graph_cell_ptr->is_marked();
+                                }
+                            ),
+                            on_moved_cb< obj_store_cell<T>>(
+                                [](obj_store_cell<T>& si) {
+                                    si.graph_cell_ptr->value = &(si.value);
+                                }
+                            ),
+                            on_survived_cb< obj_store_cell<T>>(
+                                [](obj_store_cell<T>& si, size_t promotion_age) {
+                                    auto& cell = *si.graph_cell_ptr;
+                                    if (++cell.age < promotion_age)
+                                        return false;
+                                    cell.tenured = true;
+                                    return true;
+                                }
+                            ),
+                            order_key_cb< obj_store_cell<T>>(
+                                [](const obj_store_cell<T>& si) {
+                                    return si.graph_cell_ptr->mark_order;
+                                }
+                            ),
+                            on_swept_cb< obj_store_cell<T>>(
+                                [](obj_store_cell<T>& si) {
+                                    si.graph_cell_ptr->value = nullptr;
+                                }
+                            )
+                        )
+                    )
+                );
+                if (slot >= slabs_by_slot_.size()) {
+                    slabs_by_slot_.resize(slot + 1, nullptr);
+                    types_by_slot_.resize(slot + 1, std::type_index(typeid(void)));
+                }
+                slabs_by_slot_[slot] = &iter->second;
+                types_by_slot_[slot] = std::type_index(typeid(T));
+                return iter->second;
+            }
+
+            void count_objects(type_heap_stats_map& types) const {
+                for (const auto& [key, val] : type_to_slab_) {
+                    types[key].live_objects = val.size();
+                }
+            }
+
+            // given the object counts from before a sweep in live_objects, fills in
+            // what the sweep freed and what is left.
+            void record_freed(type_heap_stats_map& types) const {
+                for (const auto& [key, val] : type_to_slab_) {
+                    auto& stats = types[key];
+                    stats.freed_objects = stats.live_objects - val.size();
+                    stats.freed_bytes = stats.freed_objects * val.object_size();
+                    stats.live_objects = val.size();
+                    stats.live_bytes = stats.live_objects * val.object_size();
+                }
+            }
+
+            void sweep_slabs(size_t num_threads) {
+                if (num_threads <= 1) {
+                    for (auto& [key, val] : type_to_slab_) {
+                        val.collect();
+                    }
+                    return;
+                }
+
+                std::vector<any_slab*> small_slabs;
+                for (auto& [key, val] : type_to_slab_) {
+                    if (val.size() >= 2 * parallel_sweep_min_range) {
+                        val.collect(num_threads);
+                    } else {
+                        small_slabs.push_back(&val);
+                    }
+                }
+                if (small_slabs.empty())
+                    return;
+
+                std::atomic<size_t> next(0);
+                run_parallel(std::min(num_threads, small_slabs.size()),
+                    [&](size_t) {
+                        for (size_t i = next++; i < small_slabs.size(); i = next++) {
+                            small_slabs[i]->collect();
+                        }
+                    }
+                );
+            }
+
+            void reset_byte_counts() {
+                size_t bytes = 0;
+                for (const auto& [key, val] : type_to_slab_) {
+                    bytes += val.size() * val.object_size();
+                }
+                live_bytes_.store(bytes, std::memory_order_relaxed);
+                allocated_bytes_.store(0, std::memory_order_relaxed);
+            }
+
+            size_t initial_capacity_;
+            bool generational_;
+            std::atomic<size_t> live_bytes_;
+            std::atomic<size_t> allocated_bytes_;
+            std::unordered_map<std::type_index, any_slab> type_to_slab_;
+            std::vector<any_slab*> slabs_by_slot_;
+            std::vector<std::type_index> types_by_slot_;
+            size_t sweep_slot_;
+        };
+
+        // the default resource for a ptr_graph's bookkeeping: a pool that takes a lock
+        // once the graph has been made concurrent.
+        class bookkeeping_resource : public std::pmr::memory_resource {
+        public:
+            bookkeeping_resource() : concurrent_(false) {
+            }
+
+            void make_concurrent() {
+                concurrent_ = true;
+            }
+
+        private:
+            void* do_allocate(size_t bytes, size_t alignment) override {
+                std::unique_lock<std::mutex> lock = lock_pool();
+                return pool_.allocate(bytes, alignment);
+            }
+
+            void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+                std::unique_lock<std::mutex> lock = lock_pool();
+                pool_.deallocate(p, bytes, alignment);
+            }
+
+            bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+                return this == &other;
+            }
+
+            std::unique_lock<std::mutex> lock_pool() {
+                if (!concurrent_)
+                    return {};
+                return std::unique_lock<std::mutex>(mutex_);
+            }
+
+            std::pmr::unsynchronized_pool_resource pool_;
+            std::mutex mutex_;
+            bool concurrent_;
+        };
+
+        // a read only view of a whole file. on posix systems the file is mapped, so
+        // pages are read in as they are touched; elsewhere it is read into a buffer.
+        class mapped_file {
+        public:
+            explicit mapped_file(const std::string& path) : data_(nullptr), size_(0) {
+#if defined(__unix__) || defined(__APPLE__)
+                int fd = ::open(path.c_str(), O_RDONLY);
+                if (fd < 0)
+                    throw std::runtime_error("gptr: cannot open " + path);
+                struct stat st;
+                if (::fstat(fd, &st) != 0) {
+                    ::close(fd);
+                    throw std::runtime_error("gptr: cannot stat " + path);
+                }
+                size_ = static_cast<size_t>(st.st_size);
+                if (size_ > 0) {
+                    void* p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+                    ::close(fd);
+                    if (p == MAP_FAILED)
+                        throw std::runtime_error("gptr: cannot map " + path);
+                    ::madvise(p, size_, MADV_SEQUENTIAL);
+                    data_ = static_cast<const char*>(p);
+                } else {
+                    ::close(fd);
+                }
+#else
+                std::ifstream in(path, std::ios::binary);
+                if (!in)
+                    throw std::runtime_error("gptr: cannot open " + path);
+                buffer_.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+                data_ = buffer_.data();
+                size_ = buffer_.size();
+#endif
+            }
+
+            mapped_file(const mapped_file&) = delete;
+            mapped_file& operator=(const mapped_file&) = delete;
+
+            ~mapped_file() {
+#if defined(__unix__) || defined(__APPLE__)
+                if (data_) {
+                    ::munmap(const_cast<char*>(data_), size_);
+                }
+#endif
+            }
+
+            const char* data() const {
+                return data_;
+            }
+
+            size_t size() const {
+                return size_;
+            }
+
+        private:
+            const char* data_;
+            size_t size_;
+#if !defined(__unix__) && !defined(__APPLE__)
+            std::vector<char> buffer_;
+#endif
+        };
+
+    }
+
+    template<typename T>
+    class graph_ptr;
+
+    class ptr_graph;
+
+    // tag selecting the thread safe ptr_graph constructor.
+    struct concurrent_t {
+        explicit concurrent_t() = default;
+    };
+    inline constexpr concurrent_t concurrent{};
+
+    // tuning knobs for ptr_graph's background collector. a collection starts when
+    // the bytes held in the object store reach the larger of target_heap_bytes
+    // and heap_growth_factor times the bytes that survived the last collection.
+    // marking is done in slices of at most max_pause; the sweep is not sliced.
+    struct gc_options {
+        size_t target_heap_bytes = 16 * 1024 * 1024;
+        double heap_growth_factor = 2.0;
+        std::chrono::microseconds max_pause = std::chrono::milliseconds(1);
+    };
+
+    template<typename T>
+    class graph_root_ptr {
+        friend ptr_graph;
+        template<typename U> friend class graph_root_ptr;
+        template<typename U> friend class graph_ptr;
+        template<typename U> friend class graph_weak_ptr;
+        template<typename U> friend class graph_extern_ptr;
+        friend class snapshot_roots;
+    public:
+
+        using value_type = T;
+
+        graph_root_ptr() : v_(0), ptr_graph_(nullptr) {
+        }
+
+        graph_root_ptr(const graph_root_ptr& v) :
+            graph_root_ptr(v.ptr_graph_, v.v_) {
+        }
+
+        graph_root_ptr(const graph_ptr<T>& v) :
+            graph_root_ptr(v.ptr_graph_, v.v_) {
+        }
+
+        graph_root_ptr(graph_root_ptr&& other) noexcept : ptr_graph_(other.ptr_graph_), v_(other.v_) {
+            other.wipe();
+        }
+
+        bool operator==(const graph_root_ptr& other) const {
+            return v_ == other.v_;
+        }
+
+        // the old target is released last, since with reference counting that can
+        // destroy it, and other may be part of it.
+        graph_root_ptr& operator=(const graph_root_ptr& other) {
+            if (&other != this) {
+                graph_root_ptr old(std::move(*this));
+                this->ptr_graph_ = other.ptr_graph_;
+                this->v_ = other.v_;
+                grab();
+            }
+            return *this;
+        }
+
+        graph_root_ptr& operator=(graph_root_ptr&& other) noexcept {
+            if (&other != this) {
+                graph_root_ptr old(std::move(*this));
+                this->ptr_graph_ = other.ptr_graph_;
+                this->v_ = other.v_;
+                other.wipe();
+            }
+            return *this;
+        }
+
+        const T* operator->() const { return get(); }
+        T* operator->() { return get(); }
+        T& operator*() { return *get(); }
+        const T& operator*()  const { return *get(); }
+        inline T* get();
+        inline const T* get() const;
+        explicit operator bool() const { return v_; }
+
+        void reset() {
+            graph_root_ptr old(std::move(*this));
+        }
+
+        ~graph_root_ptr() {
+            release();
+        }
+
+    private:
+
+        using non_const_type = std::remove_const_t<T>;
+
+        void wipe() {
+            this->ptr_graph_ = nullptr;
+            this->v_ = 0;
+        }
+
+        inline void release();
+        inline void grab();
+
+        graph_root_ptr(ptr_graph* gp, internal::obj_id_t v) : ptr_graph_(gp), v_(v) {
+            grab();
+        }
+
+        graph_root_ptr(ptr_graph* gp, internal::obj_id_t v, internal::adopt_edge_t) :
+            v_(v), ptr_graph_(gp) {
+        }
+
+        internal::obj_id_t v_;
+        ptr_graph* ptr_graph_;
+    };
+
+    template<typename T>
+    class graph_ptr {
+
+        friend class ptr_graph;
+        template<typename U> friend class graph_root_ptr;
+        template<typename U> friend class graph_ptr;
+        template<typename U> friend class graph_weak_ptr;
+        template<typename U> friend class graph_extern_ptr;
+        template<typename U> friend class enable_self_ptr;
+        friend class snapshot_writer;
+        friend class snapshot_reader;
+
+    public:
+
+        using value_type = T;
+
+        graph_ptr() :
+            u_{ 0 }, v_{ 0 }, ptr_graph_(nullptr)
         {
         }
 
-        template<typename A, typename B>
-        graph_ptr(const graph_ptr<A>& u, const graph_ptr <B>& v) :
-            graph_ptr(u.ptr_graph_, u.v_, v.v_)
-        {}
+        template<typename A, typename B>
+        graph_ptr(const graph_ptr<A>& u, const graph_ptr <B>& v) :
+            graph_ptr(u.ptr_graph_, u.v_, v.v_)
+        {}
+
+        template<typename A, typename B>
+        graph_ptr(const graph_root_ptr<A>& u, const graph_root_ptr <B>& v) :
+            graph_ptr(u.ptr_graph_, u.v_, v.v_)
+        {}
+
+        template<typename A, typename B>
+        graph_ptr(const graph_ptr<A>& u, const graph_root_ptr <B>& v) :
+            graph_ptr(u.ptr_graph_, u.v_, v.v_)
+        {}
+
+        template<typename A, typename B>
+        graph_ptr(const graph_root_ptr<A>& u, const graph_ptr <B>& v) :
+            graph_ptr(u.ptr_graph_, u.v_, v.v_)
+        {}
+
+
+        graph_ptr(const graph_ptr& other) = delete;
+
+        graph_ptr(graph_ptr&& other) noexcept :
+            ptr_graph_(other.ptr_graph_), u_(other.u_), v_(other.v_) {
+            other.wipe();
+        }
+
+        bool operator==(const graph_ptr& other) const {
+            return u_ == other.u_ && v_ == other.v_;
+        }
+
+        graph_ptr& operator=(const graph_ptr& other) = delete;
+
+        graph_ptr& operator=(graph_ptr&& other) noexcept {
+            if (&other != this) {
+                graph_ptr old(std::move(*this));
+
+                this->ptr_graph_ = other.ptr_graph_;
+                this->u_ = other.u_;
+                this->v_ = other.v_;
+
+                other.wipe();
+            }
+            return *this;
+        }
+
+        const T* operator->() const { return get(); }
+        T* operator->() { return get(); }
+        T& operator*() { return *get(); }
+        const T& operator*()  const { return *get(); }
+        inline T* get();
+        inline const T* get() const;
+
+        void reset() {
+            graph_ptr old(std::move(*this));
+        }
+
+        explicit operator bool() const { return v_; }
+
+        ~graph_ptr() {
+            release();
+        }
+
+    private:
+
+        using non_const_type = std::remove_const_t<T>;
+
+        void wipe() {
+            ptr_graph_ = nullptr;
+            u_ = 0;
+            v_ = 0;
+        }
+
+        inline void release();
+        inline void grab();
+
+        graph_ptr(ptr_graph* pg, internal::obj_id_t u, internal::obj_id_t v) : ptr_graph_(pg), u_(u), v_(v) {
+            grab();
+        }
+
+        graph_ptr(ptr_graph* pg, internal::obj_id_t u, internal::obj_id_t v, internal::adopt_edge_t) :
+            u_(u), v_(v), ptr_graph_(pg) {
+        }
+
+        internal::obj_id_t u_;
+        internal::obj_id_t v_;
+        ptr_graph* ptr_graph_;
+    };
+
+    // a non-owning reference to a graph object. it adds no edge to the graph, so
+    // it does not keep its target alive; once the target has been collected
+    // lock() returns an empty pointer.
+    template<typename T>
+    class graph_weak_ptr {
+        friend class ptr_graph;
+        friend class snapshot_writer;
+        friend class snapshot_reader;
+    public:
+
+        using value_type = T;
+
+        graph_weak_ptr() : v_(0), ptr_graph_(nullptr) {
+        }
+
+        graph_weak_ptr(const graph_root_ptr<T>& v) : v_(v.v_), ptr_graph_(v.ptr_graph_) {
+        }
+
+        graph_weak_ptr(const graph_ptr<T>& v) : v_(v.v_), ptr_graph_(v.ptr_graph_) {
+        }
+
+        bool operator==(const graph_weak_ptr& other) const {
+            return v_ == other.v_;
+        }
+
+        // a root pointer to the target, or an empty one if it has been collected.
+        inline graph_root_ptr<T> lock() const;
+        inline bool expired() const;
+
+        void reset() {
+            v_ = 0;
+            ptr_graph_ = nullptr;
+        }
+
+    private:
+        graph_weak_ptr(ptr_graph* gp, internal::obj_id_t v) : v_(v), ptr_graph_(gp) {
+        }
+
+        internal::obj_id_t v_;
+        ptr_graph* ptr_graph_;
+    };
+
+    // a pointer held by an object in one graph to an object in another. the target
+    // graph treats it as a root, so each graph can still be collected on its own
+    // and in parallel with the others. a release only takes effect at the target
+    // graph's next collection. garbage cycles that span graphs are never
+    // collected, and the target graph must outlive every pointer into it.
+    template<typename T>
+    class graph_extern_ptr {
+    public:
+
+        using value_type = T;
+
+        graph_extern_ptr() : v_(0), source_(nullptr), ptr_graph_(nullptr) {
+        }
+
+        template<typename U>
+        graph_extern_ptr(const graph_ptr<U>& holder, const graph_root_ptr<T>& target) :
+            graph_extern_ptr(holder.ptr_graph_, target.ptr_graph_, target.v_) {
+        }
+
+        template<typename U>
+        graph_extern_ptr(const graph_root_ptr<U>& holder, const graph_root_ptr<T>& target) :
+            graph_extern_ptr(holder.ptr_graph_, target.ptr_graph_, target.v_) {
+        }
+
+        graph_extern_ptr(const graph_extern_ptr&) = delete;
+        graph_extern_ptr& operator=(const graph_extern_ptr&) = delete;
+
+        graph_extern_ptr(graph_extern_ptr&& other) noexcept :
+                v_(other.v_), source_(other.source_), ptr_graph_(other.ptr_graph_) {
+            other.wipe();
+        }
+
+        graph_extern_ptr& operator=(graph_extern_ptr&& other) noexcept {
+            if (&other != this) {
+                release();
+                v_ = other.v_;
+                source_ = other.source_;
+                ptr_graph_ = other.ptr_graph_;
+                other.wipe();
+            }
+            return *this;
+        }
+
+        const T* operator->() const { return get(); }
+        T* operator->() { return get(); }
+        T& operator*() { return *get(); }
+        const T& operator*()  const { return *get(); }
+        inline T* get();
+        inline const T* get() const;
+        explicit operator bool() const { return v_; }
+
+        void reset() {
+            release();
+            wipe();
+        }
+
+        ~graph_extern_ptr() {
+            release();
+        }
+
+    private:
+
+        graph_extern_ptr(const ptr_graph* source, ptr_graph* target_graph, internal::obj_id_t v) :
+                v_(v), source_(source), ptr_graph_(target_graph) {
+            grab();
+        }
+
+        void wipe() {
+            v_ = 0;
+            source_ = nullptr;
+            ptr_graph_ = nullptr;
+        }
+
+        inline void grab();
+        inline void release();
+
+        internal::obj_id_t v_;
+        const ptr_graph* source_;
+        ptr_graph* ptr_graph_;
+    };
+
+    // the sink handed to the write functions of a snapshot_types entry.
+    class snapshot_writer {
+        friend ptr_graph;
+    public:
+        void write_bytes(const void* data, size_t n) {
+            out_->write(static_cast<const char*>(data), static_cast<std::streamsize>(n));
+        }
+
+        template<typename U, typename = std::enable_if_t<std::is_trivially_copyable_v<U>>>
+        void write(const U& value) {
+            write_bytes(&value, sizeof(U));
+        }
+
+        void write(const std::string& str) {
+            write(static_cast<std::uint64_t>(str.size()));
+            write_bytes(str.data(), str.size());
+        }
+
+        template<typename U>
+        void write(const graph_ptr<U>& ptr) {
+            write(ptr.u_);
+            write(ptr.v_);
+        }
+
+        template<typename U>
+        void write(const graph_weak_ptr<U>& ptr) {
+            write(ptr.v_);
+        }
+
+    private:
+        explicit snapshot_writer(std::ostream& out) : out_(&out) {
+        }
+
+        std::ostream* out_;
+    };
+
+    // the source handed to the read functions of a snapshot_types entry. reads
+    // past the end of the snapshot throw std::runtime_error.
+    class snapshot_reader {
+        friend ptr_graph;
+    public:
+        void read_bytes(void* data, size_t n) {
+            std::memcpy(data, consume(n), n);
+        }
+
+        template<typename U>
+        U read() {
+            static_assert(std::is_trivially_copyable_v<U>);
+            U value;
+            read_bytes(&value, sizeof(U));
+            return value;
+        }
+
+        std::string read_string() {
+            auto size = read<std::uint64_t>();
+            const char* data = consume(size);
+            return std::string(data, data + size);
+        }
+
+        // a pointer written by snapshot_writer::write(). the edge it stands for was
+        // restored with the rest of the graph, so the pointer adopts it.
+        template<typename U>
+        inline graph_ptr<U> read_ptr();
+
+        template<typename U>
+        graph_weak_ptr<U> read_weak_ptr() {
+            return graph_weak_ptr<U>(graph_, read<internal::obj_id_t>());
+        }
+
+    private:
+        snapshot_reader(ptr_graph* g, const char* data, size_t size) :
+            graph_(g), pos_(data), end_(data + size) {
+        }
+
+        const char* consume(size_t n) {
+            if (n > static_cast<size_t>(end_ - pos_))
+                throw std::runtime_error("gptr: truncated snapshot");
+            const char* data = pos_;
+            pos_ += n;
+            return data;
+        }
+
+        const char* consume_array(size_t count, size_t size) {
+            if (size > 0 && count > static_cast<size_t>(end_ - pos_) / size)
+                throw std::runtime_error("gptr: truncated snapshot");
+            return consume(count * size);
+        }
+
+        bool at_end() const {
+            return pos_ == end_;
+        }
+
+        ptr_graph* graph_;
+        const char* pos_;
+        const char* end_;
+    };
+
+    // the object types a snapshot may hold, each under a name that identifies it
+    // in the file. trivially copyable types are stored as their bytes; any other
+    // type needs a function to write an object and one to read it back. every
+    // graph_ptr an object holds has to go through write() and read_ptr(), because
+    // the edges themselves are saved with the graph.
+    class snapshot_types {
+        friend ptr_graph;
+    public:
+        template<typename T>
+        using write_fn = std::function<void(const T&, snapshot_writer&)>;
+        template<typename T>
+        using read_fn = std::function<T(snapshot_reader&)>;
+
+        template<typename T>
+        inline void add(std::string name);
+
+        template<typename T>
+        inline void add(std::string name, write_fn<T> write, read_fn<T> read);
+
+    private:
+        struct entry {
+            std::string name;
+            std::function<size_t(ptr_graph&)> count;
+            std::function<void(ptr_graph&, snapshot_writer&)> save;
+            std::function<void(ptr_graph&, snapshot_reader&, size_t, std::vector<std::type_index>&)> load;
+        };
+
+        const entry* find(const std::string& name) const {
+            for (const auto& e : entries_) {
+                if (e.name == name)
+                    return &e;
+            }
+            return nullptr;
+        }
+
+        std::vector<entry> entries_;
+    };
+
+    // the roots of a graph loaded from a snapshot. the graph holds a root edge to
+    // each of them until it is claimed by take(); whatever is left unclaimed is
+    // released when this object is destroyed.
+    class snapshot_roots {
+        friend ptr_graph;
+    public:
+        snapshot_roots(snapshot_roots&& other) noexcept :
+                graph_(other.graph_), roots_(std::move(other.roots_)) {
+            other.roots_.clear();
+        }
+
+        snapshot_roots(const snapshot_roots&) = delete;
+        snapshot_roots& operator=(const snapshot_roots&) = delete;
+        snapshot_roots& operator=(snapshot_roots&&) = delete;
+
+        size_t size() const {
+            return roots_.size();
+        }
+
+        // claims every remaining root whose object is a T, ordered by the object's
+        // slot in the saved graph, which is allocation order if nothing was freed.
+        template<typename T>
+        std::vector<graph_root_ptr<T>> take() {
+            std::vector<graph_root_ptr<T>> ptrs;
+            auto is_t = [](const auto& root) { return root.second == std::type_index(typeid(T)); };
+            for (const auto& root : roots_) {
+                if (is_t(root)) {
+                    ptrs.push_back(graph_root_ptr<T>(graph_, root.first, internal::adopt_edge_t{}));
+                }
+            }
+            roots_.erase(std::remove_if(roots_.begin(), roots_.end(), is_t), roots_.end());
+            return ptrs;
+        }
+
+        inline ~snapshot_roots();
+
+    private:
+        explicit snapshot_roots(ptr_graph* g) : graph_(g) {
+        }
+
+        ptr_graph* graph_;
+        std::vector<std::pair<internal::obj_id_t, std::type_index>> roots_;
+    };
+
+    template <typename T>
+    class enable_self_ptr {
+        friend ptr_graph;
+
+    public:
+        enable_self_ptr() :self_id_(0), ptr_graph_(nullptr) {
+        }
+
+        inline enable_self_ptr(ptr_graph& g);
+
+        graph_ptr<T> self_ptr() {
+            return graph_ptr<T>(ptr_graph_, self_id_, self_id_);
+        }
+    private:
+        internal::obj_id_t self_id_;
+        ptr_graph* ptr_graph_;
+    };
+
+    class ptr_graph {
+
+        template<typename T> friend class graph_root_ptr;
+        template<typename T> friend class graph_ptr;
+        template<typename T> friend class graph_weak_ptr;
+        template<typename T> friend class graph_extern_ptr;
+        template<typename T> friend class enable_self_ptr;
+        friend class snapshot_types;
+        friend class snapshot_reader;
+        friend class snapshot_roots;
+
+        enum class sweep_kind {
+            none,
+            full,
+            minor,
+            local,
+            lazy
+        };
+
+    public:
+        // the graph's bookkeeping, i.e. the cell table, edge lists and collector work
+        // lists, is allocated from a pool resource owned by the graph.
+        ptr_graph(size_t initial_capacity) : ptr_graph(initial_capacity, nullptr, false) {
+        }
+
+        // as above but the bookkeeping is allocated from resource, which must
+        // outlive the graph. objects are not; they live in the object store's slabs.
+        ptr_graph(size_t initial_capacity, std::pmr::memory_resource* resource) :
+                ptr_graph(initial_capacity, resource, false) {
+        }
+
+        // a ptr_graph that may be used from many threads at once. making objects,
+        // copying and destroying pointers, and get() are all safe to call
+        // concurrently. edge mutation is guarded by striped locks and allocation by
+        // a single lock. the collection functions stop the world: they wait for
+        // operations in progress on other threads to finish and block new ones
+        // until they return. raw pointers obtained from get() are, as always,
+        // invalidated by a collection, so a thread dereferencing objects while
+        // others may collect should do so under pin().
+        ptr_graph(size_t initial_capacity, concurrent_t) : ptr_graph(initial_capacity, nullptr, true) {
+        }
+
+        // a concurrent graph allocating its bookkeeping from resource, which must be
+        // thread safe. so must the resource of a graph that is later made concurrent
+        // by start_background_collection().
+        ptr_graph(size_t initial_capacity, concurrent_t, std::pmr::memory_resource* resource) :
+                ptr_graph(initial_capacity, resource, true) {
+        }
+
+        ptr_graph(const ptr_graph&) = delete;
+        ptr_graph& operator=(const ptr_graph&) = delete;
+
+        // the objects left, such as garbage cycles in reference counting mode, are
+        // destroyed along with the object store, so the edges their destructors drop
+        // must not release anything into it.
+        ~ptr_graph() {
+            stop_background_collection();
+            reclaiming_ = true;
+        }
+
+        bool is_concurrent() const {
+            return safepoint_ != nullptr;
+        }
+
+        // holds off collections for the lifetime of the returned scope, so raw
+        // pointers and references into the graph stay valid on this thread. a
+        // thread must not start a collection of this graph while it holds one.
+        internal::safepoint_scope pin() {
+            return internal::safepoint_scope(safepoint_.get());
+        }
+
+        template<typename T, typename... Args>
+        graph_root_ptr<T> make_root(Args&&... args) {
+            internal::safepoint_scope scope(safepoint_.get());
+            return graph_root_ptr<T>(
+                this,
+                make_new_cell<T>(std::forward<Args>(args)...)
+                );
+        }
+
+        template<typename T, typename U, typename... Args>
+        graph_ptr<T> make(const graph_ptr<U>& u, Args&&... args) {
+            internal::safepoint_scope scope(safepoint_.get());
+            return graph_ptr<T>(this,
+                u.v_,
+                make_new_cell<T>(std::forward<Args>(args)...)
+                );
+        }
+
+        // bulk versions of make_root and make. storage for the objects and for the
+        // new edges is reserved once and the edges are inserted under one lock.
+        // the counted overloads construct n objects from the same arguments; the
+        // range overloads construct one object from each element of args.
+
+        template<typename T, typename... Args>
+        std::vector<graph_root_ptr<T>> make_roots_batch(size_t n, const Args&... args) {
+            return make_batch<T, graph_root_ptr<T>>(0, n,
+                [&]() { return make_new_cell<T>(args...); }
+            );
+        }
+
+        template<typename T, typename Range,
+            typename = std::enable_if_t<!std::is_integral_v<Range>>>
+        std::vector<graph_root_ptr<T>> make_roots_batch(const Range& args) {
+            auto iter = std::begin(args);
+            return make_batch<T, graph_root_ptr<T>>(0, std::size(args),
+                [&]() { return make_new_cell<T>(*iter++); }
+            );
+        }
 
-        template<typename A, typename B>
-        graph_ptr(const graph_root_ptr<A>& u, const graph_root_ptr <B>& v) :
-            graph_ptr(u.ptr_graph_, u.v_, v.v_)
-        {}
+        template<typename T, typename U, typename... Args>
+        std::vector<graph_ptr<T>> make_many(const graph_ptr<U>& u, size_t n, const Args&... args) {
+            return make_batch<T, graph_ptr<T>>(u.v_, n,
+                [&]() { return make_new_cell<T>(args...); }
+            );
+        }
 
-        template<typename A, typename B>
-        graph_ptr(const graph_ptr<A>& u, const graph_root_ptr <B>& v) :
-            graph_ptr(u.ptr_graph_, u.v_, v.v_)
-        {}
+        template<typename T, typename U, typename Range,
+            typename = std::enable_if_t<!std::is_integral_v<Range>>>
+        std::vector<graph_ptr<T>> make_many(const graph_ptr<U>& u, const Range& args) {
+            auto iter = std::begin(args);
+            return make_batch<T, graph_ptr<T>>(u.v_, std::size(args),
+                [&]() { return make_new_cell<T>(*iter++); }
+            );
+        }
 
-        template<typename A, typename B>
-        graph_ptr(const graph_root_ptr<A>& u, const graph_ptr <B>& v) :
-            graph_ptr(u.ptr_graph_, u.v_, v.v_)
-        {}
+        // runs a complete stop-the-world collection. if an incremental cycle is in
+        // progress it is finished first, then a fresh cycle is run so that garbage
+        // created since that cycle began is reclaimed too. with num_threads > 1 the
+        // fresh cycle is marked and swept by that many worker threads; the set of
+        // survivors is the same as with the serial collector, but destructors of dead
+        // objects run concurrently.
+        void collect(size_t num_threads = 1) {
+            internal::stop_the_world stop(safepoint_.get());
+            auto start = std::chrono::steady_clock::now();
+            if (marking_) {
+                finish_cycle();
+            }
+            begin_cycle();
+            if (num_threads > 1 && !traversal_compaction_) {
+                parallel_mark(num_threads);
+            }
+            finish_cycle(num_threads);
+            record_pause(start);
+        }
 
+        // performs a bounded slice of incremental collection, starting a new cycle if
+        // none is in progress. budget is the number of cells scanned by the marker in
+        // this slice. returns true if the cycle completed, in which case the sweep ran
+        // as part of this call.
+        bool collect_step(size_t budget) {
+            internal::stop_the_world stop(safepoint_.get());
+            auto start = std::chrono::steady_clock::now();
+            if (!marking_) {
+                begin_cycle();
+            }
+            mark(budget);
+            bool done = gray_empty();
+            if (done) {
+                sweep();
+            }
+            record_pause(start);
+            return done;
+        }
 
-        graph_ptr(const graph_ptr& other) = delete;
+        // as above but the marking budget is a duration.
+        bool collect_step(std::chrono::nanoseconds budget) {
+            constexpr size_t cells_per_clock_check = 64;
+            internal::stop_the_world stop(safepoint_.get());
+            auto start = std::chrono::steady_clock::now();
+            auto deadline = start + budget;
+            if (!marking_) {
+                begin_cycle();
+            }
+            do {
+                mark(cells_per_clock_check);
+            } while (!gray_empty() && std::chrono::steady_clock::now() < deadline);
+            bool done = gray_empty();
+            if (done) {
+                sweep();
+            }
+            record_pause(start);
+            return done;
+        }
 
-        graph_ptr(graph_ptr&& other) noexcept :
-            ptr_graph_(other.ptr_graph_), u_(other.u_), v_(other.v_) {
-            other.wipe();
+        bool is_collecting() const {
+            return marking_;
         }
 
-        bool operator==(const graph_ptr& other) const {
-            return u_ == other.u_ && v_ == other.v_;
+        // switches to generational collection. objects allocated from now on go into
+        // per type nurseries and are promoted to the tenured slabs after surviving
+        // promotion_age minor collections. old to young edges are tracked in a
+        // remembered set so that collect_minor() only traces and sweeps young objects.
+        // collect() still collects both generations.
+        void enable_generational(size_t promotion_age = 2) {
+            internal::stop_the_world stop(safepoint_.get());
+            finish_lazy_sweep();
+            promotion_age_ = std::clamp<size_t>(promotion_age, 1, std::numeric_limits<std::uint8_t>::max());
+            if (!generational_) {
+                generational_ = true;
+                obj_store_.set_generational(true);
+            }
         }
 
-        graph_ptr& operator=(const graph_ptr& other) = delete;
+        bool is_generational() const {
+            return generational_;
+        }
 
-        graph_ptr& operator=(graph_ptr&& other) noexcept {
-            if (&other != this) {
-                release();
+        // when enabled, full collections move the survivors of each type into new
+        // blocks in the order the marker reached them, so objects that point at each
+        // other tend to share cache lines. marking is then always single threaded,
+        // since the order has to be deterministic, and the sweep needs room for a
+        // second copy of the surviving objects. minor collections are unaffected.
+        void enable_traversal_compaction(bool enable = true) {
+            internal::stop_the_world stop(safepoint_.get());
+            finish_lazy_sweep();
+            traversal_compaction_ = enable;
+        }
 
-                this->ptr_graph_ = other.ptr_graph_;
-                this->u_ = other.u_;
-                this->v_ = other.v_;
+        bool is_compacting_in_traversal_order() const {
+            return traversal_compaction_;
+        }
 
-                other.wipe();
+        // in reference counting mode every cell counts the edges into it, and an
+        // object is destroyed as soon as its count drops to zero, along with anything
+        // only it pointed to, so acyclic garbage never waits for a collection.
+        // garbage cycles are still left to the collector. objects dropped while a
+        // collection is in progress are reclaimed when it finishes. enabling the
+        // mode counts the existing edges and reclaims objects nothing points to.
+        // throws std::logic_error for a concurrent graph.
+        void enable_reference_counting(bool enable = true) {
+            internal::stop_the_world stop(safepoint_.get());
+            if (enable && is_concurrent())
+                throw std::logic_error("gptr: reference counting needs a graph that is not concurrent");
+            if (enable == counting_)
+                return;
+            finish_lazy_sweep();
+            counting_ = enable;
+            unreferenced_.clear();
+            if (counting_) {
+                count_references();
             }
-            return *this;
         }
 
-        const T* operator->() const { return get(); }
-        T* operator->() { return get(); }
-        T& operator*() { return *get(); }
-        const T& operator*()  const { return *get(); }
-        inline T* get();
-        inline const T* get() const;
+        bool is_reference_counting() const {
+            return counting_;
+        }
 
-        void reset() {
-            release();
-            wipe();
+        // keeps, for every cell, the list of cells with edges into it, which
+        // collect_from() needs. root edges are not listed; the root cell's own
+        // edge list answers whether a cell is a root. throws std::logic_error for
+        // a concurrent graph.
+        void enable_reverse_edges(bool enable = true) {
+            internal::stop_the_world stop(safepoint_.get());
+            if (enable && is_concurrent())
+                throw std::logic_error("gptr: reverse edges need a graph that is not concurrent");
+            if (enable == reverse_edges_)
+                return;
+            finish_lazy_sweep();
+            reverse_edges_ = enable;
+            if (reverse_edges_) {
+                index_reverse_edges();
+            } else {
+                for (size_t i = 0; i < in_edges_.size(); ++i) {
+                    in_edges_[i].clear();
+                }
+            }
         }
 
-        explicit operator bool() const { return v_; }
+        bool has_reverse_edges() const {
+            return reverse_edges_;
+        }
 
-        ~graph_ptr() {
-            release();
+        // with lazy sweeping a full collection only marks and runs finalizers. each
+        // dead object is destroyed later, by an allocation of its type looking for
+        // a free slot, and every allocation also sweeps a few objects or cells, so
+        // the sweep is spread over the allocations that follow the collection.
+        // sweep_step() sweeps more when the program has time, and the next
+        // collection first finishes whatever is left. until then size() still
+        // counts the dead objects, and the collection's freed counts in stats()
+        // are filled in once they have all been swept. in reference counting
+        // mode, objects whose count drops to zero while dead objects are left
+        // are only freed once those have all been swept. generational graphs and
+        // graphs compacting in traversal order sweep eagerly regardless. throws
+        // std::logic_error for a concurrent graph.
+        void enable_lazy_sweep(bool enable = true) {
+            internal::stop_the_world stop(safepoint_.get());
+            if (enable && is_concurrent())
+                throw std::logic_error("gptr: lazy sweeping needs a graph that is not concurrent");
+            if (!enable) {
+                finish_lazy_sweep();
+            }
+            lazy_sweep_ = enable;
+        }
+
+        bool has_lazy_sweep() const {
+            return lazy_sweep_;
+        }
+
+        // sweeps up to budget objects or cells left by a lazy sweep. returns true
+        // if there is nothing left to sweep.
+        bool sweep_step(size_t budget) {
+            std::lock_guard<std::recursive_mutex> lock(alloc_mutex_);
+            if (!lazy_sweep_pending())
+                return true;
+            return lazy_sweep(budget);
+        }
+
+        // collects what may have become garbage when a pointer to candidate was
+        // dropped, without tracing the whole heap. starting at candidate, each
+        // object is searched backwards along the reverse edges for a root; if none
+        // is found, everything the search visited is garbage, and the objects those
+        // point to are checked in turn. the cost is the size of the garbage found
+        // plus a backward search from each object it points to, or from candidate
+        // alone if that is still reachable. returns the number of objects freed. if
+        // an incremental cycle is in progress it is completed instead. throws
+        // std::logic_error unless reverse edges are enabled.
+        template<typename T>
+        size_t collect_from(const graph_weak_ptr<T>& candidate) {
+            if (!candidate.ptr_graph_)
+                return 0;
+            if (candidate.ptr_graph_ != this)
+                throw std::invalid_argument("gptr: collect_from() was given an object of another graph");
+            return collect_from(candidate.v_);
+        }
+
+        // drops root and collects what may have become garbage as a result.
+        template<typename T>
+        size_t collect_from(graph_root_ptr<T>&& root) {
+            graph_weak_ptr<T> candidate(root);
+            root.reset();
+            return collect_from(candidate);
+        }
+
+        // collects the young generation only. roots of the minor trace are the young
+        // targets of cells in the remembered set, which includes the root cell. if an
+        // incremental cycle is in progress it is completed instead.
+        void collect_minor() {
+            internal::stop_the_world stop(safepoint_.get());
+            auto start = std::chrono::steady_clock::now();
+            if (marking_) {
+                finish_cycle();
+                record_pause(start);
+                return;
+            }
+            if (!generational_) {
+                return;
+            }
+            process_extern_releases();
+            marks_.resize(cells_.size());
+
+            size_t edges = 0;
+            for (auto u : remembered_) {
+                for (const auto& [v, count] : cells_[u].adj_list) {
+                    shade_young(v);
+                    ++edges;
+                }
+            }
+            while (!gray_empty()) {
+                auto& cell = cell_at(next_gray());
+                cell.set_mark(true);
+                for (const auto& [v, count] : cell.adj_list) {
+                    shade_young(v);
+                    ++edges;
+                }
+            }
+            auto marked = std::chrono::steady_clock::now();
+            cycle_stats_.edges_traversed += edges;
+            cycle_stats_.mark_time += marked - start;
+
+            sweeping_ = sweep_kind::minor;
+            obj_store_.collect_nurseries(promotion_age_, cycle_stats_.types);
+            sweeping_ = sweep_kind::none;
+            collect_young_cells();
+            cycle_stats_.sweep_time += std::chrono::steady_clock::now() - marked;
+            end_collection(true);
+            release_unreferenced();
+            record_pause(start);
+        }
+
+        // starts a thread that collects whenever allocation pushes the heap past
+        // the thresholds in options. the graph becomes concurrent if it was not
+        // already, so this must not race with other uses of a graph that was not
+        // constructed with gptr::concurrent, nor with reference counting or
+        // reverse edges or lazy sweeping, which make this throw std::logic_error.
+        void start_background_collection(const gc_options& options = {}) {
+            if (background_)
+                return;
+            if (counting_ || reverse_edges_ || lazy_sweep_)
+                throw std::logic_error("gptr: reference counting, reverse edges and lazy sweeping need a graph that is not concurrent");
+            if (!is_concurrent()) {
+                make_concurrent();
+            }
+            gc_options_ = options;
+            gc_stopping_ = false;
+            gc_signalled_ = false;
+            background_ = true;
+            gc_thread_ = std::thread([this]() { run_background_collector(); });
+        }
+
+        // stops the background collector after fulfilling any pending
+        // collect_async() requests. the graph stays concurrent.
+        void stop_background_collection() {
+            if (!background_)
+                return;
+            {
+                std::lock_guard<std::mutex> lock(gc_mutex_);
+                gc_stopping_ = true;
+            }
+            gc_wake_.notify_one();
+            gc_thread_.join();
+            background_ = false;
+        }
+
+        bool is_collecting_in_background() const {
+            return background_;
+        }
+
+        // requests a full collection and returns a future that is ready once it
+        // has run. the collection runs on the background collector if there is
+        // one and otherwise on a new thread, in which case a graph that is not
+        // concurrent must not be used until the future is ready.
+        std::future<void> collect_async() {
+            if (!background_) {
+                return std::async(std::launch::async, [this]() { collect(); });
+            }
+            std::promise<void> request;
+            auto future = request.get_future();
+            {
+                std::lock_guard<std::mutex> lock(gc_mutex_);
+                gc_requests_.push_back(std::move(request));
+            }
+            gc_wake_.notify_one();
+            return future;
+        }
+
+        size_t size() const {
+            internal::safepoint_scope scope(safepoint_.get());
+            std::lock_guard<std::recursive_mutex> lock(alloc_mutex_);
+            return obj_store_.size();
+        }
+
+        // sets the function that collections call with the objects of type T they
+        // are about to destroy. pass an empty function to remove it.
+        template<typename T>
+        void set_finalizer(finalizer<T> f) {
+            internal::stop_the_world stop(safepoint_.get());
+            std::lock_guard<std::recursive_mutex> lock(alloc_mutex_);
+            obj_store_.set_finalizer<T>(std::move(f));
+        }
+
+        // bytes reserved by the object store, including capacity not holding objects.
+        size_t memory_usage() const {
+            internal::safepoint_scope scope(safepoint_.get());
+            std::lock_guard<std::recursive_mutex> lock(alloc_mutex_);
+            return obj_store_.memory_usage();
+        }
+
+        // returns the object store's unused capacity, including the initial
+        // capacity, to the allocator.
+        void shrink_to_fit() {
+            internal::stop_the_world stop(safepoint_.get());
+            finish_lazy_sweep();
+            obj_store_.shrink_to_fit();
+        }
+
+        gc_stats stats() const {
+            internal::safepoint_scope scope(safepoint_.get());
+            return stats_;
+        }
+
+        // sets a function called at the end of every collection, on the collecting
+        // thread while the world is still stopped. pass an empty function to
+        // remove it.
+        void on_collection(std::function<void(const collection_stats&)> callback) {
+            internal::stop_the_world stop(safepoint_.get());
+            collection_callback_ = std::move(callback);
+        }
+
+        // the number of objects in this graph that objects in source point to with
+        // graph_extern_ptr, including ones released since the last collection.
+        size_t external_references(const ptr_graph& source) {
+            internal::safepoint_scope scope(safepoint_.get());
+            std::lock_guard<std::mutex> lock(extern_mutex_);
+            auto iter = extern_cells_.find(&source);
+            if (iter == extern_cells_.end())
+                return 0;
+            std::unique_lock<std::mutex> edge_lock = lock_edges(iter->second);
+            return cell_at(iter->second).adj_list.size();
+        }
+
+        // writes every object and edge of the graph to path. each type of object in
+        // the graph must be registered in types. objects are written as laid out in
+        // memory, so a snapshot can only be loaded by the program that saved it.
+        // throws std::runtime_error on failure.
+        void save(const std::string& path, const snapshot_types& types) {
+            internal::stop_the_world stop(safepoint_.get());
+            if (!extern_cells_.empty())
+                throw std::runtime_error("gptr: cannot save a graph that other graphs point into");
+            finish_lazy_sweep();
+            std::vector<size_t> counts;
+            size_t num_objects = 0;
+            for (const auto& type : types.entries_) {
+                counts.push_back(type.count(*this));
+                num_objects += counts.back();
+            }
+            if (num_objects != obj_store_.size())
+                throw std::runtime_error("gptr: the graph holds objects of an unregistered type");
+
+            std::ofstream file(path, std::ios::binary | std::ios::trunc);
+            if (!file)
+                throw std::runtime_error("gptr: cannot create " + path);
+            snapshot_writer out(file);
+            out.write_bytes(snapshot_magic, sizeof(snapshot_magic));
+            out.write(static_cast<std::uint32_t>(cells_.size()));
+            for (size_t i = 0; i < cells_.size(); ++i) {
+                const auto& cell = cells_[i];
+                out.write(cell.generation);
+                out.write(static_cast<std::uint8_t>(cell.in_use));
+                out.write(static_cast<std::uint32_t>(cell.adj_list.size()));
+                for (const auto& [target, count] : cell.adj_list) {
+                    out.write(target);
+                    out.write(static_cast<std::uint64_t>(count));
+                }
+            }
+            out.write(static_cast<std::uint32_t>(types.entries_.size()));
+            for (size_t i = 0; i < types.entries_.size(); ++i) {
+                out.write(types.entries_[i].name);
+                out.write(static_cast<std::uint64_t>(counts[i]));
+                types.entries_[i].save(*this, out);
+            }
+            file.flush();
+            if (!file)
+                throw std::runtime_error("gptr: cannot write " + path);
+        }
+
+        // loads a snapshot written by save() into this graph, which must be empty.
+        // the file is mapped rather than read; objects of trivially copyable types
+        // are copied out of it a block at a time and the rest are rebuilt by their
+        // read functions. the returned roots hold the graph's root edges until they
+        // are claimed. throws std::runtime_error if the snapshot is malformed or
+        // holds a type missing from types, after which the graph must be discarded.
+        snapshot_roots load(const std::string& path, const snapshot_types& types) {
+            internal::stop_the_world stop(safepoint_.get());
+            std::lock_guard<std::recursive_mutex> lock(alloc_mutex_);
+            if (cells_.size() != 1)
+                throw std::logic_error("gptr: a snapshot can only be loaded into an empty graph");
+            finish_lazy_sweep();
+
+            internal::mapped_file file(path);
+            snapshot_reader in(this, file.data(), file.size());
+            char magic[sizeof(snapshot_magic)];
+            in.read_bytes(magic, sizeof(magic));
+            if (std::memcmp(magic, snapshot_magic, sizeof(magic)) != 0)
+                throw std::runtime_error("gptr: " + path + " is not a snapshot");
+
+            auto num_cells = in.read<std::uint32_t>();
+            for (std::uint32_t i = 0; i < num_cells; ++i) {
+                auto& cell = (i == 0) ? cells_[0] : cells_.grow();
+                auto generation = in.read<std::uint32_t>();
+                bool in_use = in.read<std::uint8_t>() != 0;
+                if (i > 0) {
+                    cell.generation = generation;
+                    cell.in_use = in_use;
+                }
+                auto num_edges = in.read<std::uint32_t>();
+                cell.adj_list.reserve(num_edges);
+                for (std::uint32_t j = 0; j < num_edges; ++j) {
+                    auto target = in.read<internal::obj_id_t>();
+                    auto count = in.read<std::uint64_t>();
+                    if (internal::id_index(target) == 0 || internal::id_index(target) >= num_cells || count == 0)
+                        throw std::runtime_error("gptr: corrupt snapshot");
+                    // root edges are handed back one per object through snapshot_roots.
+                    cell.adj_list.add(target, (i == 0) ? 1 : static_cast<size_t>(count));
+                }
+            }
+
+            std::vector<std::type_index> cell_types(cells_.size(), std::type_index(typeid(void)));
+            auto num_types = in.read<std::uint32_t>();
+            for (std::uint32_t i = 0; i < num_types; ++i) {
+                auto name = in.read_string();
+                auto count = in.read<std::uint64_t>();
+                const auto* type = types.find(name);
+                if (!type)
+                    throw std::runtime_error("gptr: snapshot holds unregistered type " + name);
+                type->load(*this, in, static_cast<size_t>(count), cell_types);
+            }
+            if (!in.at_end())
+                throw std::runtime_error("gptr: corrupt snapshot");
+
+            // every edge, the root cell's included, must name a loaded object.
+            auto check_edges = [this](const internal::ptr_graph_cell& cell) {
+                for (const auto& [target, count] : cell.adj_list) {
+                    const auto& target_cell = cell_at(target);
+                    if (!target_cell.in_use || target_cell.generation != internal::id_generation(target))
+                        throw std::runtime_error("gptr: corrupt snapshot");
+                }
+            };
+            check_edges(cells_[0]);
+            for (std::uint32_t i = num_cells; i-- > 1; ) {
+                const auto& cell = cells_[i];
+                if (!cell.in_use) {
+                    free_slots_.push_back(i);
+                    continue;
+                }
+                if (!cell.value)
+                    throw std::runtime_error("gptr: corrupt snapshot");
+                check_edges(cell);
+            }
+
+            if (counting_) {
+                count_references();
+            }
+            if (reverse_edges_) {
+                index_reverse_edges();
+            }
+
+            snapshot_roots roots(this);
+            for (const auto& [target, count] : cell_at(0).adj_list) {
+                roots.roots_.emplace_back(target, cell_types[internal::id_index(target)]);
+            }
+            std::sort(roots.roots_.begin(), roots.roots_.end(),
+                [](const auto& a, const auto& b) { return internal::id_index(a.first) < internal::id_index(b.first); });
+            return roots;
+        }
+
+        std::string debug_graph() {
+            internal::stop_the_world stop(safepoint_.get());
+            std::stringstream ss;
+            for (size_t i = 0; i < cells_.size(); ++i) {
+                const auto& cell = cells_[i];
+                if (!cell.in_use)
+                    continue;
+
+                if (cell.is_marked())
+                    ss << "[" << i << "] => ";
+                else
+                    ss << " " << i << "  => ";
+                for (const auto& [neighbor, count] : cell.adj_list) {
+                    ss << "[ " << internal::id_index(neighbor) << ": " << count << " ] ";
+                }
+               ss << "\n";
+            }
+            return ss.str();
+        }
+
+        // calls f with every object in the graph, one at a time in id order, with
+        // its retained size computed from the dominator tree of the object graph.
+        // nothing is built per object beyond what the dominator tree needs, a few
+        // words per cell and per edge, so f can stream the heap elsewhere. f must
+        // not use the graph. a lazy sweep still pending is finished first.
+        template<typename F>
+        void walk_heap(F f) {
+            internal::stop_the_world stop(safepoint_.get());
+            finish_lazy_sweep();
+            auto heap = analyze_heap();
+            heap_object obj;
+            for (size_t i = 1; i < cells_.size(); ++i) {
+                const auto& cell = cells_[i];
+                if (!cell.in_use || !cell.value)
+                    continue;
+                auto d = heap.dfnum[i];
+                obj.id = static_cast<std::uint32_t>(i);
+                obj.type = obj_store_.type_of(cell.type_slot);
+                obj.size = obj_store_.object_size(cell.type_slot);
+                obj.reachable = d != heap_analysis::none;
+                obj.retained_size = obj.reachable ? heap.retained_size[d] : 0;
+                obj.retained_objects = obj.reachable ? heap.retained_objects[d] : 0;
+                obj.is_root = heap.is_root[i];
+                obj.edges.clear();
+                for (const auto& [v, count] : cell.adj_list) {
+                    const auto& target = cell_at(v);
+                    if (target.value && target.generation == internal::id_generation(v)) {
+                        obj.edges.push_back({ internal::id_index(v), count });
+                    }
+                }
+                f(static_cast<const heap_object&>(obj));
+            }
+        }
+
+        // the objects held directly by root pointers, and the references of each
+        // graph pointing in, ordered by how many bytes each alone keeps alive, at
+        // most n of them. what several of them share is retained by none.
+        std::vector<heap_retainer> top_retainers(size_t n = std::numeric_limits<size_t>::max()) {
+            internal::stop_the_world stop(safepoint_.get());
+            finish_lazy_sweep();
+            auto heap = analyze_heap();
+            std::vector<heap_retainer> retainers;
+            for (size_t d = 1; d < heap.order.size(); ++d) {
+                // objects shared by several retainers are dominated by the root
+                // cell too, but only those with a root edge are retainers.
+                if (heap.idom[d] != 0 || !heap.is_root[heap.order[d]])
+                    continue;
+                const auto& cell = cells_[heap.order[d]];
+                heap_retainer r;
+                r.id = heap.order[d];
+                if (cell.value) {
+                    r.type = obj_store_.type_of(cell.type_slot);
+                }
+                r.retained_size = heap.retained_size[d];
+                r.retained_objects = heap.retained_objects[d];
+                retainers.push_back(r);
+            }
+            auto by_size = [](const heap_retainer& a, const heap_retainer& b) {
+                return a.retained_size > b.retained_size;
+            };
+            n = std::min(n, retainers.size());
+            std::partial_sort(retainers.begin(), retainers.begin() + n, retainers.end(), by_size);
+            retainers.resize(n);
+            return retainers;
+        }
+
+        // writes the heap to path as walk_heap() sees it, one object at a time.
+        // type names are std::type_info::name(). dot output has a node per object,
+        // labelled with its type, size and retained size, and a roots node
+        // pointing at the objects held by roots. the binary format is a sequence
+        // of records in the machine's byte order, after the 8 bytes "gptrheap":
+        // 't', a u32 type id, the name as a u64 length and its bytes, and the u64
+        // object size, before the first object of the type; 'o', the u32 id, u32
+        // type id, u64 retained size, u64 retained objects, a u8 of flags (1 for
+        // a root, 2 if reachable), a u32 edge count and that many u32 target and
+        // u64 count pairs; and a final 'e'. throws std::runtime_error on failure.
+        void write_heap_dump(const std::string& path, heap_dump_format format) {
+            std::ofstream file(path, std::ios::binary | std::ios::trunc);
+            if (!file)
+                throw std::runtime_error("gptr: cannot create " + path);
+            snapshot_writer out(file);
+            std::unordered_map<std::type_index, std::uint32_t> type_ids;
+            if (format == heap_dump_format::dot) {
+                file << "digraph heap {\n    roots [shape=box];\n";
+            } else {
+                out.write_bytes(heap_dump_magic, sizeof(heap_dump_magic));
+            }
+
+            walk_heap([&](const heap_object& obj) {
+                if (format == heap_dump_format::dot) {
+                    file << "    n" << obj.id << " [label=\"" << obj.type.name() << "\\n"
+                        << obj.size << " B, retains " << obj.retained_size << " B\"];\n";
+                    if (obj.is_root) {
+                        file << "    roots -> n" << obj.id << ";\n";
+                    }
+                    for (const auto& e : obj.edges) {
+                        file << "    n" << obj.id << " -> n" << e.target;
+                        if (e.count > 1) {
+                            file << " [label=" << e.count << "]";
+                        }
+                        file << ";\n";
+                    }
+                    return;
+                }
+
+                auto [iter, added] = type_ids.try_emplace(obj.type, static_cast<std::uint32_t>(type_ids.size()));
+                if (added) {
+                    out.write('t');
+                    out.write(iter->second);
+                    out.write(std::string(obj.type.name()));
+                    out.write(static_cast<std::uint64_t>(obj.size));
+                }
+                out.write('o');
+                out.write(obj.id);
+                out.write(iter->second);
+                out.write(static_cast<std::uint64_t>(obj.retained_size));
+                out.write(static_cast<std::uint64_t>(obj.retained_objects));
+                out.write(static_cast<std::uint8_t>((obj.is_root ? 1 : 0) | (obj.reachable ? 2 : 0)));
+                out.write(static_cast<std::uint32_t>(obj.edges.size()));
+                for (const auto& e : obj.edges) {
+                    out.write(e.target);
+                    out.write(static_cast<std::uint64_t>(e.count));
+                }
+            });
+
+            if (format == heap_dump_format::dot) {
+                file << "}\n";
+            } else {
+                out.write('e');
+            }
+            file.flush();
+            if (!file)
+                throw std::runtime_error("gptr: cannot write " + path);
         }
 
     private:
 
-        using non_const_type = std::remove_const_t<T>;
+        ptr_graph(size_t initial_capacity, std::pmr::memory_resource* resource, bool concurrent) :
+                own_resource_(resource ? nullptr : std::make_unique<internal::bookkeeping_resource>()),
+                resource_(resource ? resource : own_resource_.get()),
+                cells_(resource_), free_slots_(resource_), marks_(resource_),
+                gray_(resource_), gray_head_(0), marking_(false), sweeping_(sweep_kind::none), parallel_sweep_(false),
+                generational_(false), promotion_age_(2), traversal_compaction_(false),
+                next_mark_order_(0), counting_(false), reclaiming_(false),
+                unreferenced_(resource_), released_slots_(resource_),
+                reverse_edges_(false), in_edges_(resource_), lazy_sweep_(false), lazy_cell_(0),
+                lazy_cells_end_(0), black_cells_(resource_), young_cells_(resource_), remembered_(resource_),
+                previously_remembered_(resource_), promoted_(resource_),
+                background_(false), gc_stopping_(false), gc_signalled_(false),
+                obj_store_(initial_capacity) {
+            free_slots_.reserve(initial_capacity);
+            auto& root = cells_.grow();
+            root.in_use = true;
+            if (concurrent) {
+                make_concurrent();
+            }
+        }
 
-        void wipe() {
-            ptr_graph_ = nullptr;
-            u_ = 0;
-            v_ = 0;
+        static constexpr char snapshot_magic[8] = { 'g', 'p', 't', 'r', 's', 'n', 'a', 'p' };
+        static constexpr char heap_dump_magic[8] = { 'g', 'p', 't', 'r', 'h', 'e', 'a', 'p' };
+
+        template<typename T>
+        size_t count_objects_of() const {
+            size_t count = 0;
+            obj_store_.for_each<T>([&](const internal::obj_store_cell<T>&) { ++count; });
+            return count;
         }
 
-        inline void release();
-        inline void grab();
+        // trivially copyable objects are written as their whole obj_store_cell with
+        // the cell index stored in place of graph_cell_ptr, so they can be loaded
+        // with a memcpy per block.
+        template<typename T>
+        void save_objects(snapshot_writer& out, const snapshot_types::write_fn<T>& write) {
+            obj_store_.for_each<T>([&](const internal::obj_store_cell<T>& obj) {
+                auto index = static_cast<std::uint32_t>(cells_.index_of(obj.graph_cell_ptr));
+                if constexpr (std::is_trivially_copyable_v<T>) {
+                    internal::obj_store_cell<T> image(obj);
+                    image.graph_cell_ptr = nullptr;
+                    std::memcpy(&image.graph_cell_ptr, &index, sizeof(index));
+                    out.write_bytes(&image, sizeof(image));
+                } else {
+                    out.write(index);
+                    write(obj.value, out);
+                }
+            });
+        }
 
-        graph_ptr(ptr_graph* pg, internal::obj_id_t u, internal::obj_id_t v) : ptr_graph_(pg), u_(u), v_(v) {
-            grab();
+        template<typename T>
+        void load_objects(snapshot_reader& in, size_t count, const snapshot_types::read_fn<T>& read,
+                std::vector<std::type_index>& cell_types) {
+            auto adopt = [&](internal::obj_store_cell<T>& obj, std::uint32_t index) {
+                if (index == 0 || index >= cells_.size() || !cells_[index].in_use || cells_[index].value)
+                    throw std::runtime_error("gptr: corrupt snapshot");
+                auto& cell = cells_[index];
+                cell.value = &obj.value;
+                cell.type_slot = static_cast<std::uint32_t>(internal::type_slot<T>());
+                obj.graph_cell_ptr = &cell;
+                cell_types[index] = std::type_index(typeid(T));
+                if constexpr (std::is_base_of< enable_self_ptr<T>, T>::value) {
+                    obj.value.self_id_ = internal::make_obj_id(index, cell.generation);
+                    obj.value.ptr_graph_ = this;
+                }
+            };
+
+            if constexpr (std::is_trivially_copyable_v<T>) {
+                const char* src = in.consume_array(count, sizeof(internal::obj_store_cell<T>));
+                obj_store_.append<T>(src, count, [&](internal::obj_store_cell<T>& obj) {
+                    std::uint32_t index;
+                    std::memcpy(&index, &obj.graph_cell_ptr, sizeof(index));
+                    adopt(obj, index);
+                });
+            } else {
+                for (size_t i = 0; i < count; ++i) {
+                    auto index = in.read<std::uint32_t>();
+                    adopt(*obj_store_.emplace_tenured<T>(read(in)), index);
+                }
+            }
         }
 
-        internal::obj_id_t u_;
-        internal::obj_id_t v_;
-        ptr_graph* ptr_graph_;
-    };
+        // the pointer a snapshot_reader rebuilds for an edge restored by load().
+        template<typename T>
+        graph_ptr<T> adopt_loaded_edge(internal::obj_id_t u, internal::obj_id_t v) {
+            if (!v)
+                return {};
+            if (internal::id_index(u) >= cells_.size() || !cell_at(u).adj_list.find(v))
+                throw std::runtime_error("gptr: corrupt snapshot");
+            return graph_ptr<T>(this, u, v, internal::adopt_edge_t{});
+        }
 
-    template <typename T>
-    class enable_self_ptr {
-        friend ptr_graph;
+        void make_concurrent() {
+            if (own_resource_) {
+                own_resource_->make_concurrent();
+            }
+            safepoint_ = std::make_unique<internal::safepoint>();
+            edge_locks_ = std::vector<std::mutex>(internal::edge_lock_stripes);
+        }
+
+        bool heap_over_threshold() const {
+            size_t live = obj_store_.live_bytes();
+            size_t threshold = std::max(
+                gc_options_.target_heap_bytes,
+                static_cast<size_t>(static_cast<double>(live) * gc_options_.heap_growth_factor)
+            );
+            return live + obj_store_.allocated_bytes() >= threshold;
+        }
+
+        // called after every allocation. wakes the background collector the first
+        // time the heap crosses its threshold since the last collection.
+        void maybe_wake_collector() {
+            if (!background_ || !heap_over_threshold() || gc_signalled_.exchange(true))
+                return;
+            std::lock_guard<std::mutex> lock(gc_mutex_);
+            gc_wake_.notify_one();
+        }
+
+        // explicit requests get a full collection; threshold triggered collections
+        // are incremental, one slice of at most max_pause per stop of the world.
+        void run_background_collector() {
+            std::unique_lock<std::mutex> lock(gc_mutex_);
+            for (;;) {
+                gc_wake_.wait(lock,
+                    [&]() { return gc_stopping_ || !gc_requests_.empty() || gc_signalled_; }
+                );
+                if (gc_requests_.empty() && gc_stopping_)
+                    return;
+
+                auto requests = std::move(gc_requests_);
+                gc_requests_.clear();
+                lock.unlock();
+
+                if (!requests.empty()) {
+                    collect();
+                } else {
+                    while (!collect_step(gc_options_.max_pause)) {
+                        std::this_thread::yield();
+                    }
+                }
+                gc_signalled_ = heap_over_threshold();
+                for (auto& request : requests) {
+                    request.set_value();
+                }
+
+                lock.lock();
+            }
+        }
+
+        // marking is tri-color: white cells are unmarked, gray cells are set in the
+        // mark bitmap and on the gray list, black cells have also had their edges
+        // scanned and their own mark set. the write barrier in insert_edge() keeps a
+        // black cell from ever pointing at a white one, so the mutator may run between
+        // slices. cells allocated during a cycle are allocated black. marks are
+        // cleared by the sweep, so starting a cycle is O(1) once the last lazy
+        // sweep is done.
+        void begin_cycle() {
+            finish_lazy_sweep();
+            process_extern_releases();
+            marks_.resize(cells_.size());
+            marking_ = true;
+            next_mark_order_ = 0;
+            shade(0);
+        }
+
+        // each graph that points into this one with graph_extern_ptr is stood for
+        // by a root cell with no object, whose edges are that graph's references.
+        void insert_extern_edge(const ptr_graph* source, internal::obj_id_t v) {
+            if (source == this)
+                throw std::invalid_argument("gptr: a graph_extern_ptr must point into another graph");
+            internal::safepoint_scope scope(safepoint_.get());
+            internal::obj_id_t cell;
+            {
+                std::lock_guard<std::mutex> lock(extern_mutex_);
+                auto [iter, inserted] = extern_cells_.try_emplace(source, 0);
+                if (inserted) {
+                    iter->second = make_new_id();
+                    insert_root(iter->second);
+                }
+                cell = iter->second;
+            }
+            insert_edge(cell, v);
+        }
+
+        // releases are queued and applied by the next collection, so that sweeping
+        // one graph never waits on a collection of another.
+        void release_extern_edge(const ptr_graph* source, internal::obj_id_t v) {
+            std::lock_guard<std::mutex> lock(extern_mutex_);
+            extern_releases_.emplace_back(source, v);
+        }
+
+        void process_extern_releases() {
+            std::lock_guard<std::mutex> lock(extern_mutex_);
+            for (const auto& [source, v] : extern_releases_) {
+                auto iter = extern_cells_.find(source);
+                auto cell = iter->second;
+                remove_edge(cell, v);
+                if (cell_at(cell).adj_list.empty()) {
+                    remove_root(cell);
+                    extern_cells_.erase(iter);
+                }
+            }
+            extern_releases_.clear();
+        }
+
+        void finish_cycle(size_t num_threads = 1) {
+            mark(std::numeric_limits<size_t>::max());
+            sweep(num_threads);
+        }
+
+        void shade(internal::obj_id_t id) {
+            if (marks_.set(internal::id_index(id))) {
+                gray_.push_back(id);
+            }
+        }
+
+        bool gray_empty() const {
+            return gray_head_ == gray_.size();
+        }
+
+        // the gray list is scanned first in first out, so the cells to be scanned a
+        // few steps ahead are known and can be prefetched. traversal compaction lays
+        // cells out in the order they are scanned, so with it the list is used as a
+        // stack instead, keeping the depth first order that puts a chain's cells next
+        // to each other. the scanned prefix is dropped once it is half of the list.
+        internal::obj_id_t next_gray() {
+            constexpr size_t prefetch_distance = 8;
+            constexpr size_t min_compaction = 1024;
+
+            internal::obj_id_t id;
+            if (traversal_compaction_) {
+                id = gray_.back();
+                gray_.pop_back();
+            } else {
+                if (gray_head_ + prefetch_distance < gray_.size()) {
+                    internal::prefetch(&cell_at(gray_[gray_head_ + prefetch_distance]));
+                }
+                id = gray_[gray_head_++];
+            }
+            if (gray_head_ == gray_.size()) {
+                gray_.clear();
+                gray_head_ = 0;
+            } else if (gray_head_ >= min_compaction && 2 * gray_head_ >= gray_.size()) {
+                gray_.erase(gray_.begin(), gray_.begin() + gray_head_);
+                gray_head_ = 0;
+            }
+            return id;
+        }
+
+        void shade_young(internal::obj_id_t id) {
+            if (!cell_at(id).tenured) {
+                shade(id);
+            }
+        }
 
-    public:
-        enable_self_ptr() :self_id_(0), ptr_graph_(nullptr) {
+        void mark(size_t budget) {
+            auto start = std::chrono::steady_clock::now();
+            size_t edges = 0;
+            while (budget > 0 && !gray_empty()) {
+                auto& cell = cell_at(next_gray());
+                cell.set_mark(true);
+                cell.mark_order = next_mark_order_++;
+                const auto& adj_list = cell.adj_list;
+                for (const auto& [v, count] : adj_list) {
+                    shade(v);
+                }
+                edges += adj_list.size();
+                --budget;
+            }
+            cycle_stats_.edges_traversed += edges;
+            cycle_stats_.mark_time += std::chrono::steady_clock::now() - start;
         }
 
-        inline enable_self_ptr(ptr_graph& g);
+        // work stealing marker. each worker keeps a private stack and spills the older
+        // half of it to its shared queue once it grows past share_threshold, where idle
+        // workers can steal it. pending counts cells that have been shaded but not yet
+        // scanned; marking is done when it drops to zero. a cell is prefetched when it
+        // is pushed, as the stack usually hands it back soon after. the stacks and
+        // queues are kept between collections, empty but with their capacity.
+        void parallel_mark(size_t num_threads) {
+            constexpr size_t share_threshold = 64;
+
+            auto start = std::chrono::steady_clock::now();
+            while (mark_queues_.size() < num_threads) {
+                mark_queues_.emplace_back();
+            }
+            if (mark_stacks_.size() < num_threads) {
+                mark_stacks_.resize(num_threads);
+            }
+            auto& queues = mark_queues_;
+            std::atomic<size_t> edges(0);
+            std::atomic<size_t> pending(gray_.size() - gray_head_);
+            queues[0].push(gray_.begin() + gray_head_, gray_.end());
+            gray_.clear();
+            gray_head_ = 0;
+
+            internal::run_parallel(num_threads,
+                [&](size_t worker) {
+                    auto& local = mark_stacks_[worker];
+                    auto next = [&](internal::obj_id_t& id) {
+                        if (!local.empty()) {
+                            id = local.back();
+                            local.pop_back();
+                            return true;
+                        }
+                        if (queues[worker].pop(id))
+                            return true;
+                        for (size_t i = 1; i < num_threads; ++i) {
+                            if (queues[(worker + i) % num_threads].steal(id))
+                                return true;
+                        }
+                        return false;
+                    };
+
+                    internal::obj_id_t id;
+                    size_t num_edges = 0;
+                    for (;;) {
+                        if (!next(id)) {
+                            if (pending.load(std::memory_order_acquire) == 0)
+                                break;
+                            std::this_thread::yield();
+                            continue;
+                        }
+
+                        size_t num_shaded = 0;
+                        auto& cell = cell_at(id);
+                        cell.set_mark(true);
+                        const auto& adj_list = cell.adj_list;
+                        num_edges += adj_list.size();
+                        for (const auto& [v, count] : adj_list) {
+                            if (marks_.set(internal::id_index(v))) {
+                                internal::prefetch(&cell_at(v));
+                                local.push_back(v);
+                                ++num_shaded;
+                            }
+                        }
+                        if (num_shaded > 0)
+                            pending.fetch_add(num_shaded, std::memory_order_acq_rel);
+                        pending.fetch_sub(1, std::memory_order_acq_rel);
+
+                        if (local.size() > share_threshold) {
+                            auto half = local.begin() + local.size() / 2;
+                            queues[worker].push(local.begin(), half);
+                            local.erase(local.begin(), half);
+                        }
+                    }
+                    edges.fetch_add(num_edges, std::memory_order_relaxed);
+                }
+            );
+            cycle_stats_.edges_traversed += edges.load();
+            cycle_stats_.mark_time += std::chrono::steady_clock::now() - start;
+        }
 
-        graph_ptr<T> self_ptr() {
-            return graph_ptr<T>(ptr_graph_, self_id_, self_id_);
+        void sweep(size_t num_threads = 1) {
+            if (lazy_sweep_ && !generational_ && !traversal_compaction_) {
+                begin_lazy_sweep();
+                return;
+            }
+            auto start = std::chrono::steady_clock::now();
+            sweeping_ = sweep_kind::full;
+            parallel_sweep_ = num_threads > 1 && !traversal_compaction_;
+            obj_store_.collect(num_threads, traversal_compaction_, cycle_stats_.types);
+            parallel_sweep_ = false;
+            sweeping_ = sweep_kind::none;
+            collect_graph_cells();
+            marking_ = false;
+            cycle_stats_.sweep_time += std::chrono::steady_clock::now() - start;
+            end_collection(false);
+            release_unreferenced();
         }
-    private:
-        internal::obj_id_t self_id_;
-        ptr_graph* ptr_graph_;
-    };
 
-    class ptr_graph {
+        // ends a full collection without sweeping. the dead objects are finalized
+        // and left in place, and the marks stay on the cells, which tell the lazy
+        // sweep what is dead. cells allocated before it is done are allocated black.
+        void begin_lazy_sweep() {
+            auto start = std::chrono::steady_clock::now();
+            sweeping_ = sweep_kind::lazy;
+            obj_store_.begin_lazy_sweep(cycle_stats_.types);
+            marks_.clear();
+            marking_ = false;
+            cycle_stats_.sweep_time += std::chrono::steady_clock::now() - start;
+            end_collection(false);
+        }
 
-        template<typename T> friend class graph_root_ptr;
-        template<typename T> friend class graph_ptr;
-        template<typename T> friend class enable_self_ptr;
+        bool lazy_sweep_pending() const {
+            return sweeping_ == sweep_kind::lazy || lazy_cell_ < lazy_cells_end_;
+        }
 
-    public:
-        ptr_graph(size_t initial_capacity) : obj_store_(initial_capacity), id_(0) {
-            id_to_cell_[0] = internal::ptr_graph_cell(nullptr);
+        // does up to budget units of a lazy sweep. the objects are swept first, and
+        // once no dead object is left, the cell table, freeing the dead cells and
+        // clearing the marks of the live ones. reference counting releases, which
+        // would leave holes where the object sweep has yet to look, are held back
+        // until the objects are done. returns true when the sweep is done.
+        bool lazy_sweep(size_t budget) {
+            if (sweeping_ == sweep_kind::lazy) {
+                if (!obj_store_.sweep(budget))
+                    return false;
+                sweeping_ = sweep_kind::none;
+                record_lazy_sweep();
+                lazy_cell_ = 1;
+                lazy_cells_end_ = cells_.size();
+                release_unreferenced();
+            }
+            size_t last = lazy_cell_ + std::min(budget, lazy_cells_end_ - lazy_cell_);
+            for (; lazy_cell_ < last; ++lazy_cell_) {
+                auto& cell = cells_[lazy_cell_];
+                if (!cell.in_use)
+                    continue;
+                if (!cell.is_marked()) {
+                    free_cell(static_cast<std::uint32_t>(lazy_cell_));
+                } else {
+                    cell.set_mark(false);
+                }
+            }
+            if (lazy_cell_ < lazy_cells_end_)
+                return false;
+            lazy_cell_ = lazy_cells_end_ = 0;
+            cells_[0].set_mark(false);
+            for (auto i : black_cells_) {
+                cells_[i].set_mark(false);
+            }
+            black_cells_.clear();
+            reuse_released_slots();
+            release_unreferenced();
+            return true;
         }
 
-        template<typename T, typename... Args>
-        graph_root_ptr<T> make_root(Args&&... args) {
-            return graph_root_ptr<T>(
-                this,
-                make_new_cell<T>(std::forward<Args>(args)...)
-                );
+        void finish_lazy_sweep() {
+            if (lazy_sweep_pending()) {
+                lazy_sweep(std::numeric_limits<size_t>::max());
+            }
         }
 
-        template<typename T, typename U, typename... Args>
-        graph_ptr<T> make(const graph_ptr<U>& u, Args&&... args) {
-            return graph_ptr<T>(this,
-                u.v_,
-                make_new_cell<T>(std::forward<Args>(args)...)
-                );
+        // adds the objects destroyed by a lazy sweep to the statistics of the
+        // collection that left them.
+        void record_lazy_sweep() {
+            auto& last = stats_.last;
+            obj_store_.record_swept(last.types);
+            size_t objects = 0;
+            size_t bytes = 0;
+            for (const auto& [type, type_stats] : last.types) {
+                objects += type_stats.freed_objects;
+                bytes += type_stats.freed_bytes;
+            }
+            stats_.total_objects_freed += objects - last.objects_freed;
+            stats_.total_bytes_freed += bytes - last.bytes_freed;
+            last.objects_freed = objects;
+            last.bytes_freed = bytes;
         }
 
-        void collect() {
-            for (auto& [id, cell] : id_to_cell_) {
-                cell.gc_mark = false;
+        // folds the collection that just finished into the cumulative statistics
+        // and hands it to the collection callback.
+        void end_collection(bool minor) {
+            cycle_stats_.minor = minor;
+            for (const auto& [type, type_stats] : cycle_stats_.types) {
+                cycle_stats_.objects_freed += type_stats.freed_objects;
+                cycle_stats_.bytes_freed += type_stats.freed_bytes;
             }
 
-            std::stack<internal::obj_id_t> stack;
-            stack.push(0);
+            ++stats_.collections;
+            if (minor) {
+                ++stats_.minor_collections;
+            }
+            stats_.total_mark_time += cycle_stats_.mark_time;
+            stats_.total_sweep_time += cycle_stats_.sweep_time;
+            stats_.total_edges_traversed += cycle_stats_.edges_traversed;
+            stats_.total_objects_freed += cycle_stats_.objects_freed;
+            stats_.total_bytes_freed += cycle_stats_.bytes_freed;
+            stats_.last = std::move(cycle_stats_);
+            cycle_stats_ = {};
+
+            if (collection_callback_) {
+                collection_callback_(stats_.last);
+            }
+        }
 
-            while (!stack.empty()) {
-                auto id = stack.top();
-                stack.pop();
+        void record_pause(std::chrono::steady_clock::time_point start) {
+            auto pause = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start
+            );
+            auto micros = static_cast<size_t>(
+                std::chrono::duration_cast<std::chrono::microseconds>(pause).count()
+            );
+            size_t bucket = (micros == 0) ? 0 : internal::floor_log2(micros) + 1;
+            ++stats_.pause_histogram[std::min(bucket, gc_stats::pause_buckets - 1)];
+            ++stats_.pauses;
+            stats_.total_pause_time += pause;
+            stats_.longest_pause = std::max(stats_.longest_pause, pause);
+        }
 
-                auto& cell = id_to_cell_[id];
-                if (cell.gc_mark)
+        // unmarked cells go back on the free list with their generation bumped, so any
+        // id still referring to them no longer matches the slot. marks on surviving
+        // cells are cleared for the next cycle. in generational mode the young cell
+        // list and the remembered set are rebuilt from the survivors.
+        void collect_graph_cells() {
+            cells_[0].set_mark(false);
+            marks_.clear();
+            if (generational_) {
+                for (auto i : remembered_) {
+                    cells_[i].remembered = false;
+                }
+                young_cells_.clear();
+                remembered_.clear();
+                remember(0);
+            }
+            for (size_t i = 1; i < cells_.size(); ++i) {
+                auto& cell = cells_[i];
+                if (!cell.in_use)
+                    continue;
+                if (!cell.is_marked()) {
+                    free_cell(static_cast<std::uint32_t>(i));
                     continue;
-
-                cell.gc_mark = true;
-                for (const auto& [id, count] : cell.adj_list) {
-                    stack.push(id);
+                }
+                cell.set_mark(false);
+                if (!generational_)
+                    continue;
+                if (cell.tenured) {
+                    remember(static_cast<std::uint32_t>(i));
+                } else {
+                    young_cells_.push_back(static_cast<std::uint32_t>(i));
                 }
             }
-
-            obj_store_.collect();
-            collect_graph_cells();
+            reuse_released_slots();
         }
 
-        size_t size() const {
-            return obj_store_.size();
-        }
+        // sweeps the cells of the young generation after a minor collection. the
+        // remembered set is filtered down to cells that still point at young cells,
+        // and cells promoted by this collection are added to it if they do.
+        void collect_young_cells() {
+            promoted_.clear();
+            size_t num_young = 0;
+            for (auto i : young_cells_) {
+                auto& cell = cells_[i];
+                if (!cell.in_use)
+                    continue;
+                if (!cell.is_marked()) {
+                    free_cell(i);
+                    continue;
+                }
+                cell.set_mark(false);
+                marks_.reset(i);
+                if (cell.tenured) {
+                    promoted_.push_back(i);
+                } else {
+                    young_cells_[num_young++] = i;
+                }
+            }
+            young_cells_.resize(num_young);
 
-        std::string debug_graph() {
-            std::stringstream ss;
-            for (const auto& [id, cell] : id_to_cell_) {
+            previously_remembered_.swap(remembered_);
+            remembered_.clear();
+            for (auto i : previously_remembered_) {
+                cells_[i].remembered = false;
+            }
+            for (auto i : previously_remembered_) {
+                remember(i);
+            }
+            for (auto i : promoted_) {
+                remember(i);
+            }
+            reuse_released_slots();
+        }
 
-                if (cell.gc_mark)
-                    ss << "[" << id << "] => ";
-                else
-                    ss << " " << id << "  => ";
-                for (const auto& [neighbor, count] : cell.adj_list) {
-                    ss << "[ " << neighbor << ": " << count << " ] ";
+        // adds the cell at index to the remembered set if it is a live tenured cell
+        // with at least one edge to a young cell and is not already in the set.
+        void remember(std::uint32_t index) {
+            auto& cell = cells_[index];
+            if (!cell.in_use || !cell.tenured || cell.remembered)
+                return;
+            for (const auto& [v, count] : cell.adj_list) {
+                if (!cell_at(v).tenured) {
+                    cell.remembered = true;
+                    remembered_.push_back(index);
+                    return;
                 }
-               ss << "\n";
             }
-            return ss.str();
         }
 
-    private:
-
-        void collect_graph_cells() {
-            for (auto i = id_to_cell_.begin(); i != id_to_cell_.end();) {
-                if (!i->second.gc_mark) {
-                    i = id_to_cell_.erase(i);
-                } else {
-                    ++i;
+        // targets may have been freed already, and with a lazy sweep their slots
+        // reused, so edges into stale ids are skipped.
+        void free_cell(std::uint32_t index) {
+            auto& cell = cells_[index];
+            if (counting_) {
+                for (const auto& [v, count] : cell.adj_list) {
+                    const auto& target = cell_at(v);
+                    if (target.in_use && target.generation == internal::id_generation(v)) {
+                        unreference(v, count);
+                    }
+                }
+            }
+            if (reverse_edges_) {
+                auto u_id = internal::make_obj_id(index, cell.generation);
+                for (const auto& [v, count] : cell.adj_list) {
+                    const auto& target = cell_at(v);
+                    if (target.in_use && target.generation == internal::id_generation(v)) {
+                        in_edges_[internal::id_index(v)].remove(u_id, count);
+                    }
                 }
+                in_edges_[index].clear();
             }
+            cell.value = nullptr;
+            cell.in_use = false;
+            cell.remembered = false;
+            cell.adj_list.clear();
+            if (++cell.generation == 0)
+                cell.generation = 1;
+            free_slots_.push_back(index);
         }
 
         internal::obj_id_t make_new_id() {
-            return ++id_;;
+            internal::safepoint_scope scope(safepoint_.get());
+            std::lock_guard<std::recursive_mutex> lock(alloc_mutex_);
+            std::uint32_t index;
+            if (!free_slots_.empty()) {
+                index = free_slots_.back();
+                free_slots_.pop_back();
+            } else {
+                index = static_cast<std::uint32_t>(cells_.size());
+                cells_.grow().generation = 1;
+                marks_.resize(cells_.size());
+                if (reverse_edges_) {
+                    in_edges_.grow();
+                }
+            }
+            auto& cell = cells_[index];
+            cell.in_use = true;
+            cell.set_mark(marking_ || lazy_sweep_pending());
+            if (marking_) {
+                marks_.set(index);
+            } else if (cell.is_marked()) {
+                black_cells_.push_back(index);
+            }
+            cell.tenured = !generational_;
+            cell.age = 0;
+            cell.mark_order = std::numeric_limits<std::uint32_t>::max();
+            cell.in_degree = 0;
+            if (generational_) {
+                young_cells_.push_back(index);
+            }
+            return internal::make_obj_id(index, cell.generation);
         }
 
         template<typename T>
@@ -579,15 +4141,61 @@ namespace gptr {
 
         template<typename T, typename... Args>
         internal::obj_id_t make_new_cell(Args&&... args) {
+            std::lock_guard<std::recursive_mutex> lock(alloc_mutex_);
+            if (lazy_sweep_pending()) {
+                lazy_sweep(internal::lazy_sweep_step);
+            }
             internal::obj_store_cell<T>* obj_store_cell = obj_store_.emplace<T>(std::forward<Args>(args)...);
 
             auto id = get_id_for_cell(obj_store_cell);
-            auto [iter, success] = id_to_cell_.insert({ id, internal::ptr_graph_cell(&(obj_store_cell->value)) });
-            obj_store_cell->graph_cell_ptr = &(iter->second);
+            auto& cell = cell_at(id);
+            cell.value = &(obj_store_cell->value);
+            cell.type_slot = static_cast<std::uint32_t>(internal::type_slot<T>());
+            obj_store_cell->graph_cell_ptr = &cell;
 
+            maybe_wake_collector();
             return id;
         }
 
+        // makes n objects with make_cell() and an edge to each from u. u is 0 for
+        // root pointers.
+        template<typename T, typename Ptr, typename MakeCell>
+        std::vector<Ptr> make_batch(internal::obj_id_t u_id, size_t n, MakeCell make_cell) {
+            internal::safepoint_scope scope(safepoint_.get());
+            std::vector<internal::obj_id_t> ids;
+            ids.reserve(n);
+            {
+                std::lock_guard<std::recursive_mutex> lock(alloc_mutex_);
+                obj_store_.reserve<T>(n);
+                for (size_t i = 0; i < n; ++i) {
+                    ids.push_back(make_cell());
+                }
+            }
+            {
+                std::unique_lock<std::mutex> lock = lock_edges(u_id);
+                auto& adj_list = cell_at(u_id).adj_list;
+                adj_list.reserve(adj_list.size() + n);
+                for (auto id : ids) {
+                    link(u_id, id);
+                }
+            }
+
+            std::vector<Ptr> ptrs;
+            ptrs.reserve(n);
+            for (auto id : ids) {
+                if constexpr (std::is_same_v<Ptr, graph_root_ptr<T>>) {
+                    ptrs.push_back(Ptr(this, id, internal::adopt_edge_t{}));
+                } else {
+                    ptrs.push_back(Ptr(this, u_id, id, internal::adopt_edge_t{}));
+                }
+            }
+            return ptrs;
+        }
+
+        internal::ptr_graph_cell& cell_at(internal::obj_id_t id) {
+            return cells_[internal::id_index(id)];
+        }
+
         void insert_root(internal::obj_id_t v) {
             insert_edge(0, v);
         }
@@ -597,31 +4205,520 @@ namespace gptr {
         }
 
         void insert_edge(internal::obj_id_t u_id, internal::obj_id_t v_id) {
-            internal::ptr_graph_cell& u = id_to_cell_[u_id];
-            auto iter = u.adj_list.find(v_id);
-            if (iter == u.adj_list.end()) {
-                u.adj_list[v_id] = 1;
-            } else {
-                iter->second++;
+            internal::safepoint_scope scope(safepoint_.get());
+            std::unique_lock<std::mutex> lock = lock_edges(u_id);
+            link(u_id, v_id);
+        }
+
+        // inserts an edge with u's stripe already locked.
+        void link(internal::obj_id_t u_id, internal::obj_id_t v_id) {
+            internal::ptr_graph_cell& u = cell_at(u_id);
+            u.adj_list.add(v_id);
+            if (counting_) {
+                ++cell_at(v_id).in_degree;
+            }
+            if (reverse_edges_ && internal::id_index(u_id) != 0) {
+                in_edges_[internal::id_index(v_id)].add(u_id);
+            }
+            if (marking_ && u.is_marked()) {
+                std::unique_lock<std::mutex> barrier_lock = lock_barrier();
+                shade(v_id);
+            }
+            if (generational_ && u.tenured && !u.remembered && !cell_at(v_id).tenured) {
+                std::unique_lock<std::mutex> barrier_lock = lock_barrier();
+                u.remembered = true;
+                remembered_.push_back(internal::id_index(u_id));
             }
         }
 
         void remove_edge(internal::obj_id_t u_id, internal::obj_id_t v_id) {
-            internal::ptr_graph_cell& u = id_to_cell_[u_id];
-            auto iter = u.adj_list.find(v_id);
-            iter->second--;
-            if (iter->second == 0)
-                u.adj_list.erase(iter);
+            internal::safepoint_scope scope(safepoint_.get());
+            internal::ptr_graph_cell& u = cell_at(u_id);
+            if (sweeping_ != sweep_kind::none) {
+                // a pointer held by a dying object. edges out of a dying cell are
+                // dropped along with the cell, so there is nothing to do.
+                if (is_dying(u))
+                    return;
+                // dead objects may be being destroyed on several threads, so edges
+                // out of a live cell have to be serialized.
+                if (parallel_sweep_) {
+                    std::lock_guard<std::mutex> lock(sweep_mutex_);
+                    erase_edge(u_id, v_id);
+                    return;
+                }
+            }
+            std::unique_lock<std::mutex> lock = lock_edges(u_id);
+            erase_edge(u_id, v_id);
+        }
+
+        // during a sweep, whether the cell is about to be freed. a minor sweep only
+        // frees young cells, and collect_from() the ones it flagged. a lazy sweep
+        // counts as in progress until no dead object is left.
+        bool is_dying(const internal::ptr_graph_cell& cell) const {
+            if (sweeping_ == sweep_kind::local)
+                return cell.dying;
+            if (cell.is_marked())
+                return false;
+            return sweeping_ != sweep_kind::minor || !cell.tenured;
+        }
+
+        // in a concurrent ptr_graph these lock the stripe guarding u's edges and the
+        // shared state touched by the write barriers; otherwise they lock nothing.
+        std::unique_lock<std::mutex> lock_edges(internal::obj_id_t u_id) {
+            if (edge_locks_.empty())
+                return {};
+            return std::unique_lock<std::mutex>(
+                edge_locks_[internal::id_index(u_id) % edge_locks_.size()]
+            );
+        }
+
+        std::unique_lock<std::mutex> lock_barrier() {
+            if (!safepoint_)
+                return {};
+            return std::unique_lock<std::mutex>(barrier_mutex_);
+        }
+
+        void erase_edge(internal::obj_id_t u_id, internal::obj_id_t v_id) {
+            cell_at(u_id).adj_list.remove(v_id);
+            if (reverse_edges_ && internal::id_index(u_id) != 0) {
+                in_edges_[internal::id_index(v_id)].remove(u_id);
+            }
+            if (counting_) {
+                unreference(v_id, 1);
+                if (!marking_ && sweeping_ == sweep_kind::none) {
+                    release_unreferenced();
+                }
+            }
+        }
+
+        // drops count edges into v, queueing v for release_unreferenced() if that
+        // was the last of them. cells without an object, which are either still
+        // being constructed or stand for another graph, are left to the collector.
+        void unreference(internal::obj_id_t v, size_t count) {
+            auto& cell = cell_at(v);
+            cell.in_degree -= static_cast<std::uint32_t>(count);
+            if (cell.in_degree == 0 && cell.value) {
+                unreferenced_.push_back(v);
+            }
+        }
+
+        // destroys the queued objects that nothing points to. destructors drop the
+        // edges out of each object, which may queue further objects; the queue
+        // rather than recursion keeps long chains from exhausting the stack. an
+        // object is cleared from its cell before it is destroyed, so that it is
+        // dead to lock() and get() while its destructor runs.
+        void release_unreferenced() {
+            if (reclaiming_ || unreferenced_.empty())
+                return;
+            reclaiming_ = true;
+            std::lock_guard<std::recursive_mutex> lock(alloc_mutex_);
+            while (!unreferenced_.empty()) {
+                auto v = unreferenced_.back();
+                unreferenced_.pop_back();
+                auto& cell = cell_at(v);
+                if (cell.generation != internal::id_generation(v) || cell.in_degree != 0 || !cell.value)
+                    continue;
+                void* value = cell.value;
+                cell.value = nullptr;
+                obj_store_.finalize(cell.type_slot, value, !cell.tenured);
+                obj_store_.erase(cell.type_slot, value, !cell.tenured);
+                release_cell(internal::id_index(v));
+            }
+            reclaiming_ = false;
+        }
+
+        // frees a cell whose object was destroyed outside of a sweep. in generational
+        // mode the young cell list and the remembered set may still name the slot,
+        // so it is not reused until the next collection has rebuilt them.
+        void release_cell(std::uint32_t index) {
+            free_cell(index);
+            if (generational_) {
+                free_slots_.pop_back();
+                released_slots_.push_back(index);
+            }
+            ++stats_.objects_released;
+        }
+
+        void reuse_released_slots() {
+            free_slots_.insert(free_slots_.end(), released_slots_.begin(), released_slots_.end());
+            released_slots_.clear();
+        }
+
+        // recomputes every cell's in-degree from the edges and reclaims objects with
+        // none.
+        void count_references() {
+            for (size_t i = 0; i < cells_.size(); ++i) {
+                cells_[i].in_degree = 0;
+            }
+            for (size_t i = 0; i < cells_.size(); ++i) {
+                const auto& cell = cells_[i];
+                if (!cell.in_use)
+                    continue;
+                for (const auto& [v, count] : cell.adj_list) {
+                    cell_at(v).in_degree += static_cast<std::uint32_t>(count);
+                }
+            }
+            for (size_t i = 1; i < cells_.size(); ++i) {
+                const auto& cell = cells_[i];
+                if (cell.in_use && cell.value && cell.in_degree == 0) {
+                    unreferenced_.push_back(internal::make_obj_id(static_cast<std::uint32_t>(i), cell.generation));
+                }
+            }
+            if (!marking_) {
+                release_unreferenced();
+            }
+        }
+
+        void index_reverse_edges() {
+            while (in_edges_.size() < cells_.size()) {
+                in_edges_.grow();
+            }
+            for (size_t i = 0; i < in_edges_.size(); ++i) {
+                in_edges_[i].clear();
+            }
+            for (size_t i = 1; i < cells_.size(); ++i) {
+                const auto& cell = cells_[i];
+                if (!cell.in_use)
+                    continue;
+                auto u_id = internal::make_obj_id(static_cast<std::uint32_t>(i), cell.generation);
+                for (const auto& [v, count] : cell.adj_list) {
+                    in_edges_[internal::id_index(v)].add(u_id, count);
+                }
+            }
+        }
+
+        // the dominator tree of the cells reachable from the root cell, with the
+        // retained sizes it gives. the reachable cells are numbered in depth first
+        // preorder, and order, idom and the retained counts are indexed by that
+        // number; dfnum maps a cell index to it, or to none.
+        struct heap_analysis {
+            static constexpr std::uint32_t none = std::numeric_limits<std::uint32_t>::max();
+
+            std::vector<std::uint32_t> dfnum;
+            std::vector<std::uint32_t> order;
+            std::vector<std::uint32_t> idom;
+            std::vector<size_t> retained_size;
+            std::vector<size_t> retained_objects;
+            std::vector<bool> is_root;
+        };
+
+        // computes the dominator tree with the simple version of lengauer and
+        // tarjan's algorithm, which is O(e log n), and sums each subtree's object
+        // sizes into its root. cell 0 is the entry, so the cells it dominates
+        // immediately are the root pointers' targets, the cells standing for
+        // other graphs, and any cell shared by two or more of those.
+        heap_analysis analyze_heap() {
+            constexpr auto none = heap_analysis::none;
+            heap_analysis heap;
+            size_t num_cells = cells_.size();
+            heap.dfnum.assign(num_cells, none);
+            heap.is_root.assign(num_cells, false);
+            for (const auto& [v, count] : cells_[0].adj_list) {
+                heap.is_root[internal::id_index(v)] = true;
+            }
+            for (const auto& [source, cell] : extern_cells_) {
+                for (const auto& [v, count] : cell_at(cell).adj_list) {
+                    heap.is_root[internal::id_index(v)] = true;
+                }
+            }
+
+            // depth first search. a cell is numbered when it is popped, so its
+            // parent is the cell that pushed it.
+            auto& order = heap.order;
+            std::vector<std::uint32_t> parent;
+            std::vector<std::pair<std::uint32_t, std::uint32_t>> stack{ { 0, 0 } };
+            while (!stack.empty()) {
+                auto [i, from] = stack.back();
+                stack.pop_back();
+                if (heap.dfnum[i] != none)
+                    continue;
+                auto d = static_cast<std::uint32_t>(order.size());
+                heap.dfnum[i] = d;
+                order.push_back(i);
+                parent.push_back(from);
+                for (const auto& [v, count] : cells_[i].adj_list) {
+                    if (heap.dfnum[internal::id_index(v)] == none) {
+                        stack.emplace_back(internal::id_index(v), d);
+                    }
+                }
+            }
+            size_t n = order.size();
+
+            // the predecessors of each reachable cell, by number.
+            std::vector<std::uint32_t> first_pred(n + 1, 0);
+            for (auto i : order) {
+                for (const auto& [v, count] : cells_[i].adj_list) {
+                    ++first_pred[heap.dfnum[internal::id_index(v)] + 1];
+                }
+            }
+            for (size_t d = 0; d < n; ++d) {
+                first_pred[d + 1] += first_pred[d];
+            }
+            std::vector<std::uint32_t> preds(first_pred[n]);
+            std::vector<std::uint32_t> next_pred(first_pred.begin(), first_pred.end() - 1);
+            for (size_t d = 0; d < n; ++d) {
+                for (const auto& [v, count] : cells_[order[d]].adj_list) {
+                    preds[next_pred[heap.dfnum[internal::id_index(v)]]++] = static_cast<std::uint32_t>(d);
+                }
+            }
+
+            std::vector<std::uint32_t> semi(n), label(n), ancestor(n, none);
+            std::vector<std::uint32_t> bucket(n, none), next_in_bucket(n, none);
+            auto& idom = heap.idom;
+            idom.assign(n, 0);
+            for (size_t d = 0; d < n; ++d) {
+                semi[d] = label[d] = static_cast<std::uint32_t>(d);
+            }
+            std::vector<std::uint32_t> path;
+            auto eval = [&](std::uint32_t v) {
+                if (ancestor[v] == none)
+                    return v;
+                path.clear();
+                for (auto x = v; ancestor[ancestor[x]] != none; x = ancestor[x]) {
+                    path.push_back(x);
+                }
+                for (auto iter = path.rbegin(); iter != path.rend(); ++iter) {
+                    auto x = *iter;
+                    auto a = ancestor[x];
+                    if (semi[label[a]] < semi[label[x]]) {
+                        label[x] = label[a];
+                    }
+                    ancestor[x] = ancestor[a];
+                }
+                return label[v];
+            };
+            for (size_t w = n; w-- > 1; ) {
+                for (auto j = first_pred[w]; j < first_pred[w + 1]; ++j) {
+                    auto u = eval(preds[j]);
+                    semi[w] = std::min(semi[w], semi[u]);
+                }
+                next_in_bucket[w] = bucket[semi[w]];
+                bucket[semi[w]] = static_cast<std::uint32_t>(w);
+                auto p = parent[w];
+                ancestor[w] = p;
+                for (auto v = bucket[p]; v != none; v = next_in_bucket[v]) {
+                    auto u = eval(v);
+                    idom[v] = (semi[u] < semi[v]) ? u : p;
+                }
+                bucket[p] = none;
+            }
+            for (size_t w = 1; w < n; ++w) {
+                if (idom[w] != semi[w]) {
+                    idom[w] = idom[idom[w]];
+                }
+            }
+
+            // a cell's dominator comes before it in preorder, so one backward pass
+            // adds every subtree into its root.
+            heap.retained_size.assign(n, 0);
+            heap.retained_objects.assign(n, 0);
+            for (size_t d = n; d-- > 1; ) {
+                const auto& cell = cells_[order[d]];
+                if (cell.value) {
+                    heap.retained_size[d] += obj_store_.object_size(cell.type_slot);
+                    ++heap.retained_objects[d];
+                }
+                heap.retained_size[idom[d]] += heap.retained_size[d];
+                heap.retained_objects[idom[d]] += heap.retained_objects[d];
+            }
+            return heap;
+        }
+
+        size_t collect_from(internal::obj_id_t candidate) {
+            internal::stop_the_world stop(safepoint_.get());
+            if (!reverse_edges_)
+                throw std::logic_error("gptr: collect_from() needs reverse edges");
+            auto start = std::chrono::steady_clock::now();
+            if (marking_) {
+                finish_cycle();
+                record_pause(start);
+                return stats_.last.objects_freed;
+            }
+            finish_lazy_sweep();
+            if (!is_live(candidate)) {
+                return 0;
+            }
+
+            // cells whose fate is settled, by index: true if reachable from a root.
+            std::unordered_map<std::uint32_t, bool> known;
+            // the cells a backward search has reached, each with the cell it was
+            // reached from, and the search's queue.
+            std::unordered_map<std::uint32_t, std::uint32_t> via;
+            std::vector<std::uint32_t> queue;
+            std::vector<internal::obj_id_t> pending{ candidate };
+            std::vector<std::uint32_t> dead;
+            auto& roots = cells_[0].adj_list;
+
+            while (!pending.empty()) {
+                auto y = internal::id_index(pending.back());
+                pending.pop_back();
+                if (known.count(y))
+                    continue;
+
+                via.clear();
+                queue.clear();
+                via.emplace(y, y);
+                queue.push_back(y);
+                bool reachable = false;
+                std::uint32_t x = y;
+                for (size_t head = 0; head < queue.size() && !reachable; ++head) {
+                    x = queue[head];
+                    const auto& cell = cells_[x];
+                    // a cell without an object is under construction or stands for
+                    // another graph's references, so it counts as a root.
+                    if (!cell.value || roots.find(internal::make_obj_id(x, cell.generation))) {
+                        reachable = true;
+                        break;
+                    }
+                    for (const auto& [source, count] : in_edges_[x]) {
+                        auto s = internal::id_index(source);
+                        auto iter = known.find(s);
+                        if (iter != known.end()) {
+                            if (iter->second) {
+                                reachable = true;
+                                break;
+                            }
+                            continue;
+                        }
+                        if (via.emplace(s, x).second) {
+                            queue.push_back(s);
+                        }
+                    }
+                }
+
+                if (reachable) {
+                    // everything on the path the search took from y to x is live.
+                    for (;;) {
+                        known[x] = true;
+                        if (x == y)
+                            break;
+                        x = via[x];
+                    }
+                    continue;
+                }
+                for (auto i : queue) {
+                    known[i] = false;
+                    dead.push_back(i);
+                    for (const auto& [target, count] : cells_[i].adj_list) {
+                        if (!known.count(internal::id_index(target))) {
+                            pending.push_back(target);
+                        }
+                    }
+                }
+            }
+
+            free_local(dead);
+            record_pause(start);
+            return dead.size();
+        }
+
+        // destroys the objects of cells that collect_from() found to be garbage,
+        // finalizing all of them first, as a sweep does.
+        void free_local(const std::vector<std::uint32_t>& dead) {
+            std::lock_guard<std::recursive_mutex> lock(alloc_mutex_);
+            sweeping_ = sweep_kind::local;
+            for (auto i : dead) {
+                cells_[i].dying = true;
+            }
+            for (auto i : dead) {
+                const auto& cell = cells_[i];
+                obj_store_.finalize(cell.type_slot, cell.value, !cell.tenured);
+            }
+            for (auto i : dead) {
+                const auto& cell = cells_[i];
+                obj_store_.erase(cell.type_slot, cell.value, !cell.tenured);
+            }
+            sweeping_ = sweep_kind::none;
+            for (auto i : dead) {
+                cells_[i].dying = false;
+                release_cell(i);
+            }
+            release_unreferenced();
+        }
+
+        // whether v still names a live object. a cell that is being freed by the
+        // sweep in progress counts as dead, so a destructor cannot revive it.
+        bool is_live(internal::obj_id_t v) {
+            const auto& cell = cell_at(v);
+            if (cell.generation != internal::id_generation(v) || !cell.value)
+                return false;
+            return sweeping_ == sweep_kind::none || !is_dying(cell);
+        }
+
+        bool expired(internal::obj_id_t v) {
+            internal::safepoint_scope scope(safepoint_.get());
+            return !is_live(v);
+        }
+
+        // inserting the root edge shades the target if a cycle is in progress, so
+        // an object that was still white when locked survives the cycle.
+        template <typename T>
+        graph_root_ptr<T> lock(internal::obj_id_t v) {
+            internal::safepoint_scope scope(safepoint_.get());
+            if (!is_live(v))
+                return {};
+            return graph_root_ptr<T>(this, v);
         }
 
         template <typename T>
         T* get(internal::obj_id_t v) {
-            return static_cast<T*>(id_to_cell_[v].value);
+            internal::safepoint_scope scope(safepoint_.get());
+            const auto& cell = cell_at(v);
+            if (cell.generation != internal::id_generation(v))
+                return nullptr;
+            return static_cast<T*>(cell.value);
         }
 
-        std::unordered_map<internal::obj_id_t, internal::ptr_graph_cell> id_to_cell_;
+        std::unique_ptr<internal::bookkeeping_resource> own_resource_;
+        std::pmr::memory_resource* resource_;
+        internal::segmented_array<internal::ptr_graph_cell> cells_;
+        std::pmr::vector<std::uint32_t> free_slots_;
+        internal::mark_bitmap marks_;
+        std::pmr::vector<internal::obj_id_t> gray_;
+        size_t gray_head_;
+        bool marking_;
+        sweep_kind sweeping_;
+        bool parallel_sweep_;
+        bool generational_;
+        size_t promotion_age_;
+        bool traversal_compaction_;
+        std::uint32_t next_mark_order_;
+        bool counting_;
+        bool reclaiming_;
+        std::pmr::vector<internal::obj_id_t> unreferenced_;
+        std::pmr::vector<std::uint32_t> released_slots_;
+        bool reverse_edges_;
+        internal::segmented_array<internal::edge_list> in_edges_;
+        bool lazy_sweep_;
+        size_t lazy_cell_;
+        size_t lazy_cells_end_;
+        std::pmr::vector<std::uint32_t> black_cells_;
+        std::pmr::vector<std::uint32_t> young_cells_;
+        std::pmr::vector<std::uint32_t> remembered_;
+        std::pmr::vector<std::uint32_t> previously_remembered_;
+        std::pmr::vector<std::uint32_t> promoted_;
+        std::deque<internal::mark_queue> mark_queues_;
+        std::vector<std::vector<internal::obj_id_t>> mark_stacks_;
+        std::mutex sweep_mutex_;
+        std::unique_ptr<internal::safepoint> safepoint_;
+        std::vector<std::mutex> edge_locks_;
+        mutable std::recursive_mutex alloc_mutex_;
+        std::mutex barrier_mutex_;
+        gc_stats stats_;
+        collection_stats cycle_stats_;
+        std::function<void(const collection_stats&)> collection_callback_;
+        std::atomic<bool> background_;
+        gc_options gc_options_;
+        std::thread gc_thread_;
+        std::mutex gc_mutex_;
+        std::condition_variable gc_wake_;
+        bool gc_stopping_;
+        std::atomic<bool> gc_signalled_;
+        std::vector<std::promise<void>> gc_requests_;
+        std::mutex extern_mutex_;
+        std::unordered_map<const ptr_graph*, internal::obj_id_t> extern_cells_;
+        std::vector<std::pair<const ptr_graph*, internal::obj_id_t>> extern_releases_;
         internal::graph_obj_store obj_store_;
-        internal::obj_id_t id_;
 
     };
 
@@ -637,6 +4734,90 @@ namespace gptr {
     template<typename T>
     const T* graph_ptr<T>::get() const { return ptr_graph_->get<T>(v_); }
 
+    template<typename T>
+    graph_ptr<T> snapshot_reader::read_ptr() {
+        auto u = read<internal::obj_id_t>();
+        auto v = read<internal::obj_id_t>();
+        return graph_->adopt_loaded_edge<T>(u, v);
+    }
+
+    template<typename T>
+    void snapshot_types::add(std::string name) {
+        static_assert(std::is_trivially_copyable_v<T>,
+            "types that are not trivially copyable need write and read functions");
+        add<T>(std::move(name), nullptr, nullptr);
+    }
+
+    template<typename T>
+    void snapshot_types::add(std::string name, write_fn<T> write, read_fn<T> read) {
+        if (find(name))
+            throw std::invalid_argument("gptr: snapshot type " + name + " is already registered");
+        entries_.push_back({
+            std::move(name),
+            [](ptr_graph& g) {
+                return g.count_objects_of<T>();
+            },
+            [write](ptr_graph& g, snapshot_writer& out) {
+                g.save_objects<T>(out, write);
+            },
+            [read](ptr_graph& g, snapshot_reader& in, size_t count, std::vector<std::type_index>& cell_types) {
+                g.load_objects<T>(in, count, read, cell_types);
+            }
+        });
+    }
+
+    snapshot_roots::~snapshot_roots() {
+        for (const auto& root : roots_) {
+            graph_->remove_root(root.first);
+        }
+    }
+
+    template<typename T>
+    T* graph_extern_ptr<T>::get() { return ptr_graph_->get<T>(v_); }
+
+    template<typename T>
+    const T* graph_extern_ptr<T>::get() const { return ptr_graph_->get<T>(v_); }
+
+    template<typename T>
+    void graph_extern_ptr<T>::grab() {
+        if (ptr_graph_ && v_)
+            ptr_graph_->insert_extern_edge(source_, v_);
+    }
+
+    template<typename T>
+    void graph_extern_ptr<T>::release() {
+        if (ptr_graph_ && v_)
+            ptr_graph_->release_extern_edge(source_, v_);
+    }
+
+    // collects each graph on a thread of its own. graphs only affect each other
+    // through the release queues of graph_extern_ptr, so the collections do not
+    // wait on one another.
+    inline void collect_all(const std::vector<ptr_graph*>& graphs) {
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < graphs.size(); ++i) {
+            threads.emplace_back([g = graphs[i]]() { g->collect(); });
+        }
+        if (!graphs.empty()) {
+            graphs[0]->collect();
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    template<typename T>
+    graph_root_ptr<T> graph_weak_ptr<T>::lock() const {
+        if (!ptr_graph_ || !v_)
+            return {};
+        return ptr_graph_->lock<T>(v_);
+    }
+
+    template<typename T>
+    bool graph_weak_ptr<T>::expired() const {
+        return !ptr_graph_ || !v_ || ptr_graph_->expired(v_);
+    }
+
     template<typename T>
     void graph_ptr<T>::release() {
         if (ptr_graph_ && v_)
@@ -95,6 +95,41 @@ int main() {
         std::cout << g.debug_graph();
         std::cout << "\n";
 
+        std::cout << "what each root keeps alive:\n";
+        for (const auto& r : g.top_retainers()) {
+            std::cout << "  object " << r.id << " retains " << r.retained_objects << " objects, "
+                << r.retained_size << " bytes\n";
+        }
+        std::cout << "\n";
+    }
+
+    {
+        gptr::ptr_graph g(100);
+        g.enable_reference_counting();
+        auto cycle = make_cycle<A, B, C>(g, "foo", "bar", "baz");
+        auto d = g.make_root<D>(g, "a", "b", "c");
+
+        std::cout << "with reference counting, built a three node cycle and a tree of 4 nodes\n";
+        std::cout << "current number of objects allocated: " << g.size() << "\n\n";
+
+        std::cout << "resetting both roots...\n";
+        cycle.reset();
+        d.reset();
+        std::cout << "the tree is freed at once: " << g.size() << " objects allocated\n";
+
+        g.collect();
+        std::cout << "and the cycle by the collector: " << g.size() << " objects allocated\n";
+    }
+
+    {
+        gptr::ptr_graph g(100);
+        g.enable_reverse_edges();
+        auto cycle = make_cycle<A, B, C>(g, "foo", "bar", "baz");
+        auto d = g.make_root<D>(g, "a", "b", "c");
+
+        std::cout << "\nwith reverse edges, built a three node cycle and a tree of 4 nodes\n";
+        std::cout << "dropping the cycle's root frees " << g.collect_from(std::move(cycle)) << " objects, ";
+        std::cout << "leaving " << g.size() << " allocated\n";
     }
 
 }
@@ -0,0 +1,114 @@
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "graph_ptr.hpp"
+
+// checks the retained sizes walk_heap() reports and the retainers
+// top_retainers() picks.
+
+namespace {
+
+    struct leaf {
+        int value = 0;
+    };
+
+    struct node {
+        gptr::graph_ptr<node> next;
+        gptr::graph_ptr<leaf> shared;
+    };
+
+    bool failed = false;
+
+    void check(bool condition, const std::string& what) {
+        if (!condition) {
+            std::printf("failed: %s\n", what.c_str());
+            failed = true;
+        }
+    }
+
+    // a leaf pointed to by two rooted nodes is retained by neither and is not a
+    // retainer itself once its own root is gone.
+    void shared_object() {
+        gptr::ptr_graph g(16);
+        auto a = g.make_root<node>();
+        auto b = g.make_root<node>();
+        auto l = g.make_root<leaf>();
+        a->shared = gptr::graph_ptr<leaf>(a, l);
+        b->shared = gptr::graph_ptr<leaf>(b, l);
+        l.reset();
+
+        auto retainers = g.top_retainers();
+        check(retainers.size() == 2, "only the two rooted nodes are retainers");
+        for (const auto& r : retainers) {
+            check(r.type == std::type_index(typeid(node)), "a retainer is a node");
+            check(r.retained_objects == 1, "a node does not retain the shared leaf");
+        }
+    }
+
+    // each node of a chain retains the rest of it, and garbage retains nothing.
+    void chain() {
+        constexpr size_t length = 10;
+        gptr::ptr_graph g(16);
+        auto head = g.make_root<node>();
+        {
+            gptr::graph_root_ptr<node> tail = head;
+            for (size_t i = 1; i < length; ++i) {
+                gptr::graph_ptr<node> self(tail, tail);
+                tail->next = g.make<node>(self);
+                tail = gptr::graph_root_ptr<node>(tail->next);
+            }
+        }
+        g.make_root<node>();
+
+        size_t reachable = 0;
+        size_t garbage = 0;
+        std::vector<size_t> retained;
+        g.walk_heap([&](const gptr::heap_object& obj) {
+            if (!obj.reachable) {
+                check(obj.retained_objects == 0 && obj.retained_size == 0, "garbage retains nothing");
+                ++garbage;
+                return;
+            }
+            ++reachable;
+            retained.push_back(obj.retained_objects);
+            check(obj.retained_size == obj.retained_objects * obj.size, "retained bytes match retained objects");
+        });
+        check(reachable == length && garbage == 1, "the walk sees the chain and the garbage node");
+        std::sort(retained.begin(), retained.end());
+        for (size_t i = 0; i < retained.size(); ++i) {
+            check(retained[i] == i + 1, "each node retains the rest of the chain");
+        }
+
+        auto retainers = g.top_retainers();
+        check(retainers.size() == 1 && retainers[0].retained_objects == length, "the head retains the chain");
+    }
+
+    // a walk after a lazy collection sees none of the dead objects.
+    void lazy_sweep() {
+        gptr::ptr_graph g(16);
+        g.enable_lazy_sweep();
+        auto keep = g.make_root<node>();
+        for (size_t i = 0; i < 100; ++i) {
+            auto a = g.make_root<node>();
+            gptr::graph_ptr<node> self(a, a);
+            a->next = g.make<node>(self);
+        }
+        g.collect();
+
+        size_t objects = 0;
+        g.walk_heap([&](const gptr::heap_object& obj) {
+            check(obj.reachable, "the walk sees only live objects");
+            ++objects;
+        });
+        check(objects == 1, "the dead objects are swept before the walk");
+    }
+
+}
+
+int main() {
+    shared_object();
+    chain();
+    lazy_sweep();
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,77 @@
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+#include "graph_ptr.hpp"
+
+// checks that collect(n) with several marking threads leaves exactly the objects
+// a serial collect() does. both graphs are built from the same seed, so the same
+// objects get the same ids, and debug_graph() lists the ids left in use along
+// with their edges.
+
+namespace {
+
+    struct node {
+        gptr::graph_ptr<node> left;
+        gptr::graph_ptr<node> right;
+    };
+
+    struct heap {
+        gptr::ptr_graph g{ 16 };
+        std::vector<gptr::graph_root_ptr<node>> roots;
+    };
+
+    // random edges between n objects make cycles of every size; dropping most
+    // roots leaves both reachable cycles and garbage ones.
+    void build(heap& h, unsigned seed, size_t n) {
+        std::mt19937 rng(seed);
+        for (size_t i = 0; i < n; ++i) {
+            h.roots.push_back(h.g.make_root<node>());
+        }
+        for (size_t i = 0; i < 2 * n; ++i) {
+            auto& u = h.roots[rng() % n];
+            auto& v = h.roots[rng() % n];
+            if (rng() % 2) {
+                u->left = gptr::graph_ptr<node>(u, v);
+            } else {
+                u->right = gptr::graph_ptr<node>(u, v);
+            }
+        }
+        for (auto& root : h.roots) {
+            if (rng() % 8 != 0) {
+                root.reset();
+            }
+        }
+    }
+
+    bool same_survivors(unsigned seed, size_t n, size_t num_threads) {
+        heap serial;
+        heap parallel;
+        build(serial, seed, n);
+        build(parallel, seed, n);
+        serial.g.collect();
+        parallel.g.collect(num_threads);
+
+        if (serial.g.size() != parallel.g.size()) {
+            std::printf("seed %u, %zu threads: %zu objects survive serial marking, %zu parallel\n",
+                seed, num_threads, serial.g.size(), parallel.g.size());
+            return false;
+        }
+        if (serial.g.debug_graph() != parallel.g.debug_graph()) {
+            std::printf("seed %u, %zu threads: different objects survive\n", seed, num_threads);
+            return false;
+        }
+        return true;
+    }
+
+}
+
+int main() {
+    bool ok = true;
+    for (unsigned seed = 1; seed <= 20; ++seed) {
+        for (size_t num_threads : { 2, 4, 8 }) {
+            ok = same_survivors(seed, (seed % 2) ? 1000 : 20000, num_threads) && ok;
+        }
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,37 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "graph_ptr.hpp"
+
+// collecting from inside a constructor, i.e. from a thread already inside the
+// graph, while another thread is inside it too. the collection has to wake up
+// when the other thread leaves; ctest's timeout catches it if it does not.
+
+namespace {
+
+    std::atomic<bool> pinned(false);
+    std::atomic<bool> collected(false);
+
+    struct collects_on_construction {
+        explicit collects_on_construction(gptr::ptr_graph& g) {
+            g.collect();
+            collected = true;
+        }
+    };
+
+}
+
+int main() {
+    gptr::ptr_graph g(16, gptr::concurrent);
+    std::thread other([&]() {
+        auto pin = g.pin();
+        pinned = true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    });
+    while (!pinned) {
+        std::this_thread::yield();
+    }
+    auto root = g.make_root<collects_on_construction>(g);
+    other.join();
+    return (collected && g.size() == 1) ? 0 : 1;
+}